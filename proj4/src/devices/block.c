@@ -3,7 +3,9 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A block device. */
 struct block
@@ -19,8 +21,71 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue, if the driver enabled it. */
+    bool queued;                        /* Do requests go through it? */
+    enum block_sched sched;             /* Its scheduler. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct list sorted;                 /* Waiting requests, by sector. */
+    struct list fifo;                   /* Waiting requests, by arrival. */
+    bool busy;                          /* Is a thread dispatching? */
+    block_sector_t head;                /* Sector after the last run. */
+  };
+
+/* Request queue.
+
+   A disk serves one request at a time, and moving its head
+   between distant sectors costs more than the transfer.  So a
+   block device whose driver calls block_enable_queue() queues
+   the requests of the threads that want it, and its scheduler
+   picks the order in which to serve them.
+
+   There is no I/O thread.  Instead, a thread that finds the
+   device idle becomes its dispatcher: it takes the run of
+   requests the scheduler picks, performs it with the queue
+   unlocked, and wakes the threads whose requests it completed,
+   until its own request is done.  It then hands the device to
+   the thread of the next request to go, if any.  Meanwhile,
+   other threads queue their requests, which gives the scheduler
+   a choice, and a run takes in every queued request in the same
+   direction for the sectors that follow its first, up to
+   BLOCK_MERGE_MAX sectors, so that it is one transfer instead of
+   several.  A driver that provides the read_sg and write_sg
+   operations performs each such transfer with a single command. */
+#define BLOCK_MERGE_MAX 64
+
+/* Ticks after which the deadline scheduler serves a read or a
+   write ahead of its place in sector order.  Reads are more
+   urgent, because their threads are waiting for the data. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (TIMER_FREQ * 5)
+
+/* A request for a range of consecutive sectors, waiting in a
+   block device's queue.  The sectors go to or from BUFFER, one
+   after another, or, if BUFFERS is non-null, each to or from its
+   own element of BUFFERS. */
+struct block_request
+  {
+    struct list_elem sorted_elem;       /* Element in sorted list or run. */
+    struct list_elem fifo_elem;         /* Element in fifo list. */
+    block_sector_t sector;              /* First sector to transfer. */
+    size_t cnt;                         /* Number of sectors. */
+    uint8_t *buffer;                    /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    void *const *buffers;               /* CNT sector buffers. */
+    bool write;                         /* Write or read? */
+    int64_t deadline;                   /* Tick to serve it by. */
+    bool done;                          /* Transferred? */
+    struct semaphore sema;              /* Upped when done, or when its
+                                           thread is to dispatch. */
   };
 
+/* Scheduler for block devices that enable their queues, as set
+   by the -iosched kernel option. */
+static enum block_sched default_sched = BLOCK_SCHED_DEADLINE;
+
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      void *buffer, void *const buffers[], bool write);
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -99,17 +164,18 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/* Verifies that SECTOR is a valid offset within BLOCK.
-   Panics if not. */
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
 static void
-check_sector (struct block *block, block_sector_t sector)
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
 {
-  if (sector >= block->size)
+  if (sector >= block->size || cnt > block->size - sector)
     {
       /* We do not use ASSERT because we want to panic here
          regardless of whether NDEBUG is defined. */
       PANIC ("Access past end of device %s (sector=%"PRDSNu", "
-             "size=%"PRDSNu")\n", block_name (block), sector, block->size);
+             "cnt=%zu, size=%"PRDSNu")\n",
+             block_name (block), sector, cnt, block->size);
     }
 }
 
@@ -120,9 +186,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multi (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +197,61 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
+  block_write_multi (block, sector, 1, buffer);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Costs the device as few commands as it allows, rather
+   than one per sector. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffer)
+{
+  check_sectors (block, sector, cnt);
+  transfer (block, sector, cnt, buffer, NULL, false);
+  block->read_cnt += cnt;
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *buffer)
+{
+  check_sectors (block, sector, cnt);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer (block, sector, cnt, (void *) buffer, NULL, true);
+  block->write_cnt += cnt;
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK, the Ith
+   of them into BUFFERS[I], which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Like block_read_multi(), but the
+   buffers need not be adjacent in memory. */
+void
+block_read_sg (struct block *block, block_sector_t sector,
+               void *const buffers[], size_t cnt)
+{
+  check_sectors (block, sector, cnt);
+  transfer (block, sector, cnt, NULL, buffers, false);
+  block->read_cnt += cnt;
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK, the Ith of
+   them from BUFFERS[I], which must contain BLOCK_SECTOR_SIZE
+   bytes.  Like block_write_multi(), but the buffers need not be
+   adjacent in memory. */
+void
+block_write_sg (struct block *block, block_sector_t sector,
+                const void *const buffers[], size_t cnt)
+{
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  transfer (block, sector, cnt, NULL, (void *const *) buffers, true);
+  block->write_cnt += cnt;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -200,6 +315,7 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->queued = false;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +327,312 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Makes requests for BLOCK wait in a queue, served in the order
+   chosen by the scheduler configured with -iosched.  A driver
+   should call this for a device that is a physical disk, not for
+   one that passes its requests on to another device, as a
+   partition does. */
+void
+block_enable_queue (struct block *block)
+{
+  lock_init (&block->queue_lock);
+  list_init (&block->sorted);
+  list_init (&block->fifo);
+  block->sched = default_sched;
+  block->busy = false;
+  block->head = 0;
+  block->queued = true;
+}
+
+/* Makes block devices that enable their queues from now on use
+   the scheduler called NAME: "noop", "clook" or "deadline". */
+void
+block_configure_sched (const char *name)
+{
+  static const char *sched_names[BLOCK_SCHED_CNT] =
+    {
+      "noop",
+      "clook",
+      "deadline",
+    };
+  enum block_sched sched;
+
+  for (sched = 0; sched < BLOCK_SCHED_CNT; sched++)
+    if (!strcmp (name, sched_names[sched]))
+      {
+        default_sched = sched;
+        return;
+      }
+  PANIC ("unknown I/O scheduler `%s'", name);
+}
+
+/* Makes BLOCK's queue use scheduler SCHED from now on. */
+void
+block_set_sched (struct block *block, enum block_sched sched)
+{
+  ASSERT (block->queued);
+  ASSERT (sched < BLOCK_SCHED_CNT);
+
+  lock_acquire (&block->queue_lock);
+  block->sched = sched;
+  lock_release (&block->queue_lock);
+}
+
+/* Orders block requests by sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request,
+                                              sorted_elem);
+  const struct block_request *b = list_entry (b_, struct block_request,
+                                              sorted_elem);
+  return a->sector < b->sector;
+}
+
+/* Returns the request in BLOCK's queue that its scheduler would
+   serve next, or a null pointer if the queue is empty.  Caller
+   must hold BLOCK's queue lock. */
+static struct block_request *
+pick (struct block *block)
+{
+  struct list_elem *e;
+
+  if (list_empty (&block->fifo))
+    return NULL;
+
+  switch (block->sched)
+    {
+    case BLOCK_SCHED_NOOP:
+      return list_entry (list_front (&block->fifo), struct block_request,
+                         fifo_elem);
+
+    case BLOCK_SCHED_DEADLINE:
+      /* The oldest request that has expired, if any. */
+      for (e = list_begin (&block->fifo); e != list_end (&block->fifo);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                fifo_elem);
+          if (r->deadline <= timer_ticks ())
+            return r;
+        }
+      /* Fall through. */
+
+    case BLOCK_SCHED_CLOOK:
+    default:
+      /* The first request at or past the head, or the lowest one
+         if there is none. */
+      for (e = list_begin (&block->sorted); e != list_end (&block->sorted);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                sorted_elem);
+          if (r->sector >= block->head)
+            return r;
+        }
+      return list_entry (list_front (&block->sorted), struct block_request,
+                         sorted_elem);
+    }
+}
+
+/* Removes R from BLOCK's queue, along with the queued requests in
+   the same direction for the sectors that follow it, up to
+   BLOCK_MERGE_MAX sectors in all (or just R, if R alone is
+   bigger), and puts them into RUN in sector order.  Caller must
+   hold BLOCK's queue lock. */
+static void
+take_run (struct block *block, struct block_request *r, struct list *run)
+{
+  struct list_elem *e = list_next (&r->sorted_elem);
+  block_sector_t next = r->sector + r->cnt;
+  size_t cnt = r->cnt;
+
+  list_remove (&r->sorted_elem);
+  list_remove (&r->fifo_elem);
+  list_push_back (run, &r->sorted_elem);
+
+  while (e != list_end (&block->sorted))
+    {
+      struct block_request *m = list_entry (e, struct block_request,
+                                            sorted_elem);
+      e = list_next (e);
+
+      /* Skip other requests that start within the run. */
+      if (m->sector < next)
+        continue;
+      if (m->sector != next || m->write != r->write
+          || cnt + m->cnt > BLOCK_MERGE_MAX)
+        break;
+
+      list_remove (&m->sorted_elem);
+      list_remove (&m->fifo_elem);
+      list_push_back (run, &m->sorted_elem);
+      next += m->cnt;
+      cnt += m->cnt;
+    }
+  block->head = next;
+}
+
+/* Returns the buffer for the Ith sector of request R. */
+static void *
+request_buffer (const struct block_request *r, size_t i)
+{
+  return (r->buffers != NULL
+          ? r->buffers[i]
+          : r->buffer + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Has BLOCK's driver transfer the CNT sectors starting at SECTOR
+   to or from BUFFERS, according to WRITE. */
+static void
+perform_sg (struct block *block, block_sector_t sector,
+            void *const buffers[], size_t cnt, bool write)
+{
+  size_t i;
+
+  if (write && block->ops->write_sg != NULL)
+    block->ops->write_sg (block->aux, sector,
+                          (const void *const *) buffers, cnt);
+  else if (!write && block->ops->read_sg != NULL)
+    block->ops->read_sg (block->aux, sector, buffers, cnt);
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        if (write)
+          block->ops->write (block->aux, sector + i, buffers[i]);
+        else
+          block->ops->read (block->aux, sector + i, buffers[i]);
+      }
+}
+
+/* Transfers the sectors of the requests in RUN, which are
+   consecutive and all in the same direction, BLOCK_MERGE_MAX
+   sectors at a time. */
+static void
+perform (struct block *block, struct list *run)
+{
+  void *buffers[BLOCK_MERGE_MAX];
+  block_sector_t sector = 0;
+  size_t cnt = 0;
+  bool write = false;
+  struct list_elem *e;
+
+  for (e = list_begin (run); e != list_end (run); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request,
+                                            sorted_elem);
+      size_t i;
+
+      if (e == list_begin (run))
+        {
+          sector = r->sector;
+          write = r->write;
+        }
+      for (i = 0; i < r->cnt; i++)
+        {
+          buffers[cnt++] = request_buffer (r, i);
+          if (cnt == BLOCK_MERGE_MAX)
+            {
+              perform_sg (block, sector, buffers, cnt, write);
+              sector += cnt;
+              cnt = 0;
+            }
+        }
+    }
+  if (cnt > 0)
+    perform_sg (block, sector, buffers, cnt, write);
+}
+
+/* Serves runs of requests from BLOCK's queue until OWN is done,
+   then hands BLOCK to the thread of the next request to go, or
+   marks it idle.  Caller must hold BLOCK's queue lock and be its
+   dispatcher. */
+static void
+dispatch (struct block *block, struct block_request *own)
+{
+  struct block_request *next;
+
+  while (!own->done)
+    {
+      struct list run;
+
+      list_init (&run);
+      take_run (block, pick (block), &run);
+      lock_release (&block->queue_lock);
+      perform (block, &run);
+      lock_acquire (&block->queue_lock);
+
+      while (!list_empty (&run))
+        {
+          struct block_request *r = list_entry (list_pop_front (&run),
+                                                struct block_request,
+                                                sorted_elem);
+          r->done = true;
+          if (r != own)
+            sema_up (&r->sema);
+        }
+    }
+
+  next = pick (block);
+  if (next != NULL)
+    sema_up (&next->sema);
+  else
+    block->busy = false;
+}
+
+/* Transfers the CNT sectors of BLOCK starting at SECTOR to or
+   from BUFFER or BUFFERS, as in struct block_request, according
+   to WRITE.  If BLOCK has a queue, queues the request and waits
+   until it is done. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *buffer, void *const buffers[], bool write)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.buffers = buffers;
+  r.write = write;
+
+  if (!block->queued)
+    {
+      struct list run;
+
+      list_init (&run);
+      list_push_back (&run, &r.sorted_elem);
+      perform (block, &run);
+      return;
+    }
+
+  r.deadline = timer_ticks () + (write ? WRITE_EXPIRE : READ_EXPIRE);
+  r.done = false;
+  sema_init (&r.sema, 0);
+
+  lock_acquire (&block->queue_lock);
+  list_insert_ordered (&block->sorted, &r.sorted_elem, request_less, NULL);
+  list_push_back (&block->fifo, &r.fifo_elem);
+  if (block->busy)
+    {
+      /* Wait until the dispatcher has done R, or has handed the
+         device to us. */
+      lock_release (&block->queue_lock);
+      sema_down (&r.sema);
+      if (r.done)
+        return;
+      lock_acquire (&block->queue_lock);
+    }
+  else
+    block->busy = true;
+  dispatch (block, &r);
+  lock_release (&block->queue_lock);
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
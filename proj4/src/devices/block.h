@@ -53,11 +53,31 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        const void *);
+void block_read_sg (struct block *, block_sector_t,
+                    void *const buffers[], size_t cnt);
+void block_write_sg (struct block *, block_sector_t,
+                     const void *const buffers[], size_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
 void block_print_stats (void);
+
+/* I/O schedulers, which choose the order in which a block
+   device serves the requests waiting in its queue. */
+enum block_sched
+  {
+    BLOCK_SCHED_NOOP,            /* Order of arrival. */
+    BLOCK_SCHED_CLOOK,           /* Ascending sectors, wrapping around. */
+    BLOCK_SCHED_DEADLINE,        /* C-LOOK, but expired requests first. */
+    BLOCK_SCHED_CNT              /* Number of schedulers. */
+  };
+
+void block_configure_sched (const char *name);
+void block_set_sched (struct block *, enum block_sched);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,10 +85,20 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors, the Ith of
+       them to or from BUFFERS[I], with as few commands as the
+       device allows.  If null, the block layer calls READ or
+       WRITE once per sector instead. */
+    void (*read_sg) (void *aux, block_sector_t,
+                     void *const buffers[], size_t cnt);
+    void (*write_sg) (void *aux, block_sector_t,
+                      const void *const buffers[], size_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_enable_queue (struct block *);
 
 #endif /* devices/block.h */
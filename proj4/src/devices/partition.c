@@ -317,8 +317,30 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads the CNT sectors starting at SECTOR from partition P, the
+   Ith of them into BUFFERS[I], in one request to P's disk. */
+static void
+partition_read_sg (void *p_, block_sector_t sector,
+                   void *const buffers[], size_t cnt)
+{
+  struct partition *p = p_;
+  block_read_sg (p->block, p->start + sector, buffers, cnt);
+}
+
+/* Writes the CNT sectors starting at SECTOR to partition P, the
+   Ith of them from BUFFERS[I], in one request to P's disk. */
+static void
+partition_write_sg (void *p_, block_sector_t sector,
+                    const void *const buffers[], size_t cnt)
+{
+  struct partition *p = p_;
+  block_write_sg (p->block, p->start + sector, buffers, cnt);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_sg,
+    partition_write_sg
   };
@@ -1,6 +1,6 @@
 /* cat.c
 
-Copies one file to another. */
+Copies one file to another, by cloning it if possible. */
 
 #include <stdio.h>
 #include <syscall.h>
@@ -24,6 +24,11 @@ main (int argc, char *argv[])
       return EXIT_FAILURE;
     }
 
+  /* Share the input file's data if the file system can, and
+     otherwise copy it. */
+  if (clone_file (in_fd, argv[2]))
+    return EXIT_SUCCESS;
+
   /* Create and open output file. */
   if (!create (argv[2], filesize (in_fd))) 
     {
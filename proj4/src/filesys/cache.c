@@ -0,0 +1,798 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* The buffer cache sits between the file system and fs_device.
+   Every sector the file system reads or writes is staged in one
+   of a fixed number of cache entries, and dirty entries are only
+   written back when they are evicted, when the flusher thread
+   gets to them, or when the cache is flushed.
+
+   Each entry holds one file system block of fs_block_sectors
+   sectors and is read and written as a unit.  The interface is
+   still in sectors: an access to any sector goes to the entry for
+   the block that contains it, and may extend to the end of that
+   block.
+
+   Synchronization is two-level.  CACHE_LOCK protects the
+   sector-to-entry mapping and each entry's bookkeeping (sector,
+   pin count, reference bit).  Each entry's own LOCK protects its
+   data and is held across the disk I/O that fills or writes back
+   that entry, so different sectors can be transferred
+   concurrently.  An entry with a nonzero pin count is never
+   chosen for eviction.
+
+   The journal holds the sectors that belong to its running
+   transaction (see cache_write_held_at()).  A held entry is
+   neither evicted nor written back until the journal has logged
+   it and released it with cache_release_held(). */
+
+/* A cached block. */
+struct cache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in cache_map. */
+    block_sector_t sector;              /* First sector of block, if mapped. */
+    bool mapped;                        /* In cache_map? */
+    bool dirty;                         /* Modified since read? */
+    int64_t dirty_time;                 /* Tick when it became dirty. */
+    bool accessed;                      /* Reference bit for clock. */
+    bool held;                          /* Held by the journal? */
+    int pin_cnt;                        /* Threads using this entry. */
+    struct lock lock;                   /* Protects DATA. */
+    uint8_t *data;                      /* One block of data. */
+  };
+
+/* Requested number of blocks to cache (-cache option).  Each
+   entry holds one file system block, so the cache keeps this
+   many blocks whatever the block size. */
+static size_t cache_size = CACHE_DEFAULT_SIZE;
+
+/* Fewest entries in the cache. */
+#define CACHE_MIN_ENTRIES 8
+
+static struct cache_entry *cache;       /* Array of ENTRY_CNT entries. */
+static size_t entry_cnt;                /* Number of entries. */
+static size_t block_bytes;              /* Bytes in one entry. */
+static struct hash cache_map;           /* Maps sectors to entries. */
+static size_t clock_hand;               /* Next eviction candidate. */
+static struct lock cache_lock;          /* Protects the above. */
+static struct condition cache_unpinned; /* Signaled when pin_cnt hits 0. */
+static size_t dirty_cnt;                /* Number of dirty entries. */
+static size_t held_cnt;                 /* Number of held entries. */
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Lookups found in cache. */
+static unsigned long long miss_cnt;     /* Lookups that read the disk. */
+static unsigned long long evict_cnt;    /* Mapped entries replaced. */
+
+/* Read-ahead queue.  Sectors that are likely to be read soon are
+   queued here and fetched into the cache by a background thread.
+   Requests are only hints: when the queue is full they are
+   dropped. */
+#define READAHEAD_QUEUE_SIZE 64
+static block_sector_t ra_queue[READAHEAD_QUEUE_SIZE];
+static size_t ra_head;                  /* Index of oldest request. */
+static size_t ra_cnt;                   /* Number of queued requests. */
+static struct lock ra_lock;             /* Protects the queue. */
+static struct condition ra_nonempty;    /* Signaled when RA_CNT > 0. */
+static unsigned long long readahead_cnt; /* Sectors prefetched. */
+
+/* Write-behind policy.  The flusher thread wakes up every
+   FLUSH_POLL ticks.  Every FLUSH_INTERVAL ticks it writes back
+   the sectors that have been dirty for at least FLUSH_MAX_AGE
+   ticks.  When the number of dirty sectors reaches the high
+   watermark, a writer asks it to write back everything at its
+   next wakeup. */
+#define FLUSH_POLL (TIMER_FREQ / 20)
+#define FLUSH_INTERVAL TIMER_FREQ
+#define FLUSH_MAX_AGE (2 * TIMER_FREQ)
+#define FLUSH_HIGH_WATERMARK(SIZE) ((SIZE) * 3 / 4)
+static bool flush_wanted;               /* Watermark reached?
+                                           Protected by cache_lock. */
+
+static void write_back (struct cache_entry *);
+static void write_behind (bool all);
+static thread_func readahead_daemon;
+static thread_func flusher_daemon;
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+
+/* Sets the number of blocks held by the cache to BLOCK_CNT,
+   which cache_init() raises to at least CACHE_MIN_ENTRIES.
+   Must be called before cache_init(). */
+void
+cache_configure (int block_cnt)
+{
+  ASSERT (cache == NULL);
+  if (block_cnt <= 0)
+    PANIC ("invalid cache size %d", block_cnt);
+  cache_size = block_cnt;
+}
+
+/* Initializes the buffer cache, with entries of fs_block_sectors
+   sectors. */
+void
+cache_init (void)
+{
+  size_t page_cnt;
+  uint8_t *pages;
+  size_t i;
+
+  block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+  entry_cnt = cache_size;
+  if (entry_cnt < CACHE_MIN_ENTRIES)
+    entry_cnt = CACHE_MIN_ENTRIES;
+  page_cnt = DIV_ROUND_UP (entry_cnt * block_bytes, PGSIZE);
+
+  cache = calloc (entry_cnt, sizeof *cache);
+  pages = palloc_get_multiple (0, page_cnt);
+  if (cache == NULL || pages == NULL
+      || !hash_init (&cache_map, cache_hash, cache_less, NULL))
+    PANIC ("buffer cache allocation failed");
+
+  for (i = 0; i < entry_cnt; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->mapped = false;
+      e->dirty = false;
+      e->accessed = false;
+      e->held = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock);
+      e->data = pages + i * block_bytes;
+    }
+  clock_hand = 0;
+  dirty_cnt = 0;
+  held_cnt = 0;
+  flush_wanted = false;
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+
+  ra_head = ra_cnt = 0;
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+}
+
+/* Starts the thread that writes dirty sectors back in the
+   background. */
+void
+cache_start_flusher (void)
+{
+  thread_create ("flusher", PRI_DEFAULT, flusher_daemon, NULL);
+}
+
+/* Returns the number of sectors held by the cache. */
+size_t
+cache_capacity (void)
+{
+  return entry_cnt * fs_block_sectors;
+}
+
+/* Returns the mapped entry for the block that starts at SECTOR,
+   or a null pointer.  Caller must hold cache_lock. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  struct cache_entry key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&cache_map, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, hash_elem) : NULL;
+}
+
+/* Advances the clock hand until it finds an unpinned, unheld
+   entry whose reference bit is clear, clearing reference bits on
+   the way.
+   Returns a null pointer if every entry is pinned or held.
+   Caller must hold cache_lock. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  /* Two sweeps are enough to clear every reference bit. */
+  for (i = 0; i < 2 * entry_cnt; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % entry_cnt;
+
+      if (e->pin_cnt > 0 || e->held)
+        continue;
+      if (!e->mapped)
+        return e;
+      if (e->accessed)
+        e->accessed = false;
+      else
+        return e;
+    }
+  return NULL;
+}
+
+/* Returns the first sector of the block that contains SECTOR. */
+static inline block_sector_t
+block_start (block_sector_t sector)
+{
+  return sector - sector % fs_block_sectors;
+}
+
+/* Reads the block that starts at SECTOR into DATA. */
+static void
+read_block (block_sector_t sector, uint8_t *data)
+{
+  block_read_multi (fs_device, sector, fs_block_sectors, data);
+}
+
+/* Writes DATA to the block that starts at SECTOR. */
+static void
+write_block (block_sector_t sector, const uint8_t *data)
+{
+  block_write_multi (fs_device, sector, fs_block_sectors, data);
+}
+
+/* Returns the entry for the block that contains SECTOR, pinned
+   and with its lock held.  If the block is not already cached,
+   evicts another entry to make room and, if FILL is true, reads
+   the block from disk; otherwise the caller is expected to
+   overwrite the whole entry.
+
+   If PREFETCH is true, the caller only wants the block brought
+   into the cache: returns a null pointer without touching the
+   entry if the block is already cached. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool fill, bool prefetch)
+{
+  struct cache_entry *e;
+
+  sector = block_start (sector);
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = lookup (sector);
+      if (e != NULL && prefetch)
+        {
+          lock_release (&cache_lock);
+          return NULL;
+        }
+      else if (e != NULL)
+        {
+          /* Hit.  The entry's lock may be held by a thread that
+             is still reading it in, so wait for it outside
+             cache_lock. */
+          e->pin_cnt++;
+          e->accessed = true;
+          hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      e = choose_victim ();
+      if (e == NULL)
+        {
+          cond_wait (&cache_unpinned, &cache_lock);
+          continue;
+        }
+
+      if (e->dirty)
+        {
+          /* Write the victim back while it is still mapped, so
+             that a concurrent lookup of its sector waits for the
+             write instead of reading stale data from disk.  Then
+             start over, since the world may have changed. */
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          write_back (e);
+          lock_release (&e->lock);
+          lock_acquire (&cache_lock);
+          if (--e->pin_cnt == 0)
+            cond_broadcast (&cache_unpinned, &cache_lock);
+          continue;
+        }
+
+      /* Clean victim: remap it to SECTOR. */
+      if (e->mapped)
+        {
+          hash_delete (&cache_map, &e->hash_elem);
+          evict_cnt++;
+        }
+      e->sector = sector;
+      e->mapped = true;
+      e->accessed = true;
+      e->pin_cnt = 1;
+      hash_insert (&cache_map, &e->hash_elem);
+      if (prefetch)
+        readahead_cnt++;
+      else
+        miss_cnt++;
+
+      /* Nobody holds an unpinned entry's lock, so this does not
+         block. */
+      lock_acquire (&e->lock);
+      lock_release (&cache_lock);
+
+      if (fill)
+        read_block (sector, e->data);
+      return e;
+    }
+}
+
+/* Writes entry E to disk if it is dirty and not held by the
+   journal.  E's owner may have made it held since it was chosen,
+   so this checks again under E's lock, which a held write also
+   takes.  Caller must hold E's lock and not cache_lock. */
+static void
+write_back (struct cache_entry *e)
+{
+  if (e->dirty && !e->held)
+    {
+      write_block (e->sector, e->data);
+      e->dirty = false;
+
+      lock_acquire (&cache_lock);
+      dirty_cnt--;
+      lock_release (&cache_lock);
+    }
+}
+
+/* Releases entry E obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_broadcast (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns the byte offset within its cache entry of byte OFFSET
+   within SECTOR, checking that SIZE bytes from there stay within
+   the entry. */
+static off_t
+entry_offset (block_sector_t sector, off_t size, off_t offset)
+{
+  offset += (sector % fs_block_sectors) * BLOCK_SECTOR_SIZE;
+  ASSERT (offset >= 0 && size >= 0 && offset + size <= (off_t) block_bytes);
+  return offset;
+}
+
+/* Returns true if holding one more block would make more than
+   MAX_HELD sectors held.  Caller must hold CACHE_LOCK. */
+static bool
+held_full (size_t max_held)
+{
+  return (held_cnt + 1) * fs_block_sectors > max_held;
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+   OFFSET.  If MAX_HELD is nonzero, also holds SECTOR's block for
+   the journal, unless that would make more than MAX_HELD sectors
+   held, in which case nothing is written.  Returns true if
+   successful. */
+static bool
+write_at (block_sector_t sector, const void *buffer,
+          off_t size, off_t offset, size_t max_held)
+{
+  bool fill = size < (off_t) block_bytes;
+  struct cache_entry *e;
+
+  offset = entry_offset (sector, size, offset);
+
+  /* Refuse before mapping an entry for SECTOR if we can, since a
+     whole-block write does not read the block in. */
+  if (max_held > 0)
+    {
+      bool full;
+
+      lock_acquire (&cache_lock);
+      e = lookup (block_start (sector));
+      full = (e == NULL || !e->held) && held_full (max_held);
+      lock_release (&cache_lock);
+      if (full)
+        return false;
+    }
+  e = cache_get (sector, fill, false);
+
+  lock_acquire (&cache_lock);
+  if (max_held > 0 && !e->held)
+    {
+      if (held_full (max_held))
+        {
+          /* Another writer took the last slot meanwhile.  The
+             entry may just have been mapped to SECTOR without
+             being read in, so read it in for other readers; a
+             clean entry matches the disk anyway. */
+          bool stale = !fill && !e->dirty;
+
+          lock_release (&cache_lock);
+          if (stale)
+            read_block (block_start (sector), e->data);
+          cache_put (e);
+          return false;
+        }
+      e->held = true;
+      held_cnt++;
+    }
+  if (!e->dirty)
+    {
+      e->dirty = true;
+      e->dirty_time = timer_ticks ();
+      if (++dirty_cnt >= FLUSH_HIGH_WATERMARK (entry_cnt))
+        flush_wanted = true;
+    }
+  lock_release (&cache_lock);
+
+  memcpy (e->data + offset, buffer, size);
+  cache_put (e);
+  return true;
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Reads SIZE bytes starting at byte OFFSET within SECTOR into
+   BUFFER.  The bytes may run on into the following sectors of
+   the same block. */
+void
+cache_read_at (block_sector_t sector, void *buffer, off_t size, off_t offset)
+{
+  struct cache_entry *e;
+
+  offset = entry_offset (sector, size, offset);
+  e = cache_get (sector, true, false);
+  memcpy (buffer, e->data + offset, size);
+  cache_put (e);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR.
+   The data reaches the disk when the sector is evicted or the
+   cache is flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+   OFFSET, running on into the following sectors of the same
+   block if necessary.  The rest of the block is preserved. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                off_t size, off_t offset)
+{
+  write_at (sector, buffer, size, offset, 0);
+}
+
+/* Like cache_write_at(), but also holds SECTOR's block in the
+   cache on behalf of the journal, so that it is not written back
+   to disk until released by cache_release_held().  If holding
+   the block would make more than MAX_HELD sectors held, writes
+   nothing and returns false; otherwise returns true. */
+bool
+cache_write_held_at (block_sector_t sector, const void *buffer,
+                     off_t size, off_t offset, size_t max_held)
+{
+  return write_at (sector, buffer, size, offset, max_held);
+}
+
+/* Returns the number of sectors held for the journal, counting
+   every sector of each held block. */
+size_t
+cache_held_cnt (void)
+{
+  return held_cnt * fs_block_sectors;
+}
+
+/* Stores every sector of the held blocks into SECTORS, in
+   ascending order, as far as MAX sectors allow, and returns the
+   number stored. */
+size_t
+cache_held_sectors (block_sector_t sectors[], size_t max)
+{
+  size_t cnt = 0;
+  size_t i, j, k;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < entry_cnt && cnt + fs_block_sectors <= max; i++)
+    if (cache[i].held)
+      {
+        /* Insertion sort of whole blocks; there are few held
+           sectors. */
+        for (j = cnt; j > 0 && sectors[j - 1] > cache[i].sector;
+             j -= fs_block_sectors)
+          for (k = 1; k <= fs_block_sectors; k++)
+            sectors[j - k + fs_block_sectors] = sectors[j - k];
+        for (k = 0; k < fs_block_sectors; k++)
+          sectors[j + k] = cache[i].sector + k;
+        cnt += fs_block_sectors;
+      }
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Releases every held sector.  They stay dirty, so they are
+   written back later like any other dirty sector. */
+void
+cache_release_held (void)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < entry_cnt; i++)
+    cache[i].held = false;
+  held_cnt = 0;
+  cond_broadcast (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Asks for SECTOR to be read into the cache in the background,
+   because the caller expects to read it soon. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < READAHEAD_QUEUE_SIZE)
+    {
+      ra_queue[(ra_head + ra_cnt) % READAHEAD_QUEUE_SIZE] = sector;
+      ra_cnt++;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Read-ahead thread.  Fetches queued sectors into the cache in
+   the order they were requested. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      struct cache_entry *e;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % READAHEAD_QUEUE_SIZE;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      e = cache_get (sector, true, true);
+      if (e != NULL)
+        cache_put (e);
+    }
+}
+
+/* Flusher thread.  Applies the write-behind policy described
+   above FLUSH_POLL. */
+static void
+flusher_daemon (void *aux UNUSED)
+{
+  int64_t last_flush = timer_ticks ();
+
+  for (;;)
+    {
+      bool wanted;
+
+      timer_sleep (FLUSH_POLL);
+      lock_acquire (&cache_lock);
+      wanted = flush_wanted;
+      flush_wanted = false;
+      lock_release (&cache_lock);
+
+      if (wanted)
+        {
+          write_behind (true);
+          last_flush = timer_ticks ();
+        }
+      else if (timer_elapsed (last_flush) >= FLUSH_INTERVAL)
+        {
+          write_behind (false);
+          last_flush = timer_ticks ();
+        }
+    }
+}
+
+/* Compares the sectors of the cache entries that A and B point
+   to, for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const struct cache_entry *const *a = a_;
+  const struct cache_entry *const *b = b_;
+  block_sector_t sa = (*a)->sector, sb = (*b)->sector;
+
+  return sa < sb ? -1 : sa > sb;
+}
+
+/* Writes back the CNT pinned entries in RUN, which hold adjacent
+   blocks in ascending order, through BUFFERS, which must have
+   room for one pointer per sector.  An entry that the journal has
+   held since write_behind() chose it must not be written home,
+   so it splits the run, and each stretch of entries between held
+   ones goes out in a single scatter-gather write.  Entries in a
+   stretch that are no longer dirty are written again along with
+   the others, which is harmless, since they match the disk.
+   Releases the entries. */
+static void
+write_back_run (struct cache_entry **run, size_t cnt, const void **buffers)
+{
+  size_t dirty = 0;
+  size_t first, i;
+  unsigned j;
+
+  for (i = 0; i < cnt; i++)
+    lock_acquire (&run[i]->lock);
+
+  for (first = 0; first < cnt; first = i + 1)
+    {
+      size_t stretch_dirty = 0;
+
+      for (i = first; i < cnt && !run[i]->held; i++)
+        {
+          for (j = 0; j < fs_block_sectors; j++)
+            buffers[(i - first) * fs_block_sectors + j]
+              = run[i]->data + j * BLOCK_SECTOR_SIZE;
+          if (run[i]->dirty)
+            {
+              run[i]->dirty = false;
+              stretch_dirty++;
+            }
+        }
+      if (stretch_dirty > 0)
+        block_write_sg (fs_device, run[first]->sector, buffers,
+                        (i - first) * fs_block_sectors);
+      dirty += stretch_dirty;
+    }
+
+  for (i = 0; i < cnt; i++)
+    cache_put (run[i]);
+  lock_acquire (&cache_lock);
+  dirty_cnt -= dirty;
+  lock_release (&cache_lock);
+}
+
+/* Returns true if write_behind() should write back entry E,
+   given ALL and the current tick NOW.  Caller must hold
+   cache_lock. */
+static bool
+is_due (const struct cache_entry *e, bool all, int64_t now)
+{
+  return (e->mapped && e->dirty && !e->held
+          && (all || now - e->dirty_time >= FLUSH_MAX_AGE));
+}
+
+/* Writes back the entries that write_behind() would, one at a
+   time and in no particular order.  For when write_behind()
+   cannot allocate memory, so it allocates none. */
+static void
+write_behind_each (bool all, int64_t now)
+{
+  size_t i;
+
+  for (i = 0; i < entry_cnt; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      bool due;
+
+      lock_acquire (&cache_lock);
+      due = is_due (e, all, now);
+      if (due)
+        e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      if (due)
+        {
+          lock_acquire (&e->lock);
+          write_back (e);
+          cache_put (e);
+        }
+    }
+}
+
+/* Writes dirty entries back to disk in ascending sector order,
+   each run of entries for adjacent blocks in a single write.
+   If ALL is true, writes every dirty entry; otherwise only
+   those that have been dirty for at least FLUSH_MAX_AGE
+   ticks. */
+static void
+write_behind (bool all)
+{
+  struct cache_entry **batch;
+  const void **buffers;
+  int64_t now = timer_ticks ();
+  size_t batch_cnt = 0;
+  size_t i, run_cnt;
+
+  batch = malloc (entry_cnt * sizeof *batch);
+  buffers = malloc (entry_cnt * fs_block_sectors * sizeof *buffers);
+  if (batch == NULL || buffers == NULL)
+    {
+      free (batch);
+      free (buffers);
+      write_behind_each (all, now);
+      return;
+    }
+
+  /* Pin the entries to write, so that they keep their sectors. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < entry_cnt; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (is_due (e, all, now))
+        {
+          e->pin_cnt++;
+          batch[batch_cnt++] = e;
+        }
+    }
+  lock_release (&cache_lock);
+
+  qsort (batch, batch_cnt, sizeof *batch, compare_sectors);
+  for (i = 0; i < batch_cnt; i += run_cnt)
+    {
+      for (run_cnt = 1; i + run_cnt < batch_cnt; run_cnt++)
+        if (batch[i + run_cnt]->sector
+            != batch[i + run_cnt - 1]->sector + fs_block_sectors)
+          break;
+      write_back_run (batch + i, run_cnt, buffers);
+    }
+  free (buffers);
+  free (batch);
+}
+
+/* Writes every dirty entry that is not held back to disk. */
+void
+cache_flush (void)
+{
+  if (cache != NULL)
+    write_behind (true);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  if (cache != NULL)
+    printf ("Buffer cache: %zu blocks of %zu bytes, %llu hits, "
+            "%llu misses, %llu evictions, %llu read-ahead\n",
+            entry_cnt, block_bytes, hit_cnt, miss_cnt, evict_cnt,
+            readahead_cnt);
+}
+
+/* Returns a hash value for the cache entry containing E. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_entry *ce = hash_entry (e, struct cache_entry, hash_elem);
+  return hash_int (ce->sector);
+}
+
+/* Returns true if cache entry A's sector precedes B's. */
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  const struct cache_entry *ca = hash_entry (a, struct cache_entry, hash_elem);
+  const struct cache_entry *cb = hash_entry (b, struct cache_entry, hash_elem);
+  return ca->sector < cb->sector;
+}
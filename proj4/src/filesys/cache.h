@@ -0,0 +1,33 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Default number of file system blocks held by the buffer
+   cache. */
+#define CACHE_DEFAULT_SIZE 64
+
+void cache_configure (int block_cnt);
+void cache_init (void);
+void cache_start_flusher (void);
+size_t cache_capacity (void);
+void cache_flush (void);
+
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, off_t size, off_t offset);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, off_t size, off_t offset);
+void cache_readahead (block_sector_t);
+
+bool cache_write_held_at (block_sector_t, const void *, off_t size,
+                          off_t offset, size_t max_held);
+size_t cache_held_cnt (void);
+size_t cache_held_sectors (block_sector_t[], size_t max);
+void cache_release_held (void);
+
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,228 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* The dentry cache remembers the outcome of recent directory
+   lookups, keyed by the sector of the directory's inode and the
+   name looked up.  A positive entry records the sector of the
+   named inode; a negative entry records that the name does not
+   exist, so that repeated lookups of missing names do not read
+   the directory either.
+
+   The directory code keeps the cache coherent: dir_add() and
+   dir_remove() update the entry for the name they change, and
+   dir_create() and dir_remove() drop every entry for a directory
+   whose sector is being reused or freed.  The cache holds
+   DCACHE_SIZE entries and evicts the least recently used. */
+
+/* A cached directory entry. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache_map. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated name. */
+    bool negative;                      /* Name known not to exist? */
+    block_sector_t sector;              /* Inode sector, if positive. */
+  };
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct hash dcache_map;          /* Maps (DIR, NAME) to dentries. */
+static struct list lru_list;            /* Most recently used first. */
+static struct list free_list;           /* Unused dentries. */
+static struct lock dcache_lock;         /* Protects the above. */
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Positive hits. */
+static unsigned long long negative_cnt; /* Negative hits. */
+static unsigned long long miss_cnt;     /* Lookups not in cache. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  if (!hash_init (&dcache_map, dentry_hash, dentry_less, NULL))
+    PANIC ("dentry cache allocation failed");
+  list_init (&lru_list);
+  list_init (&free_list);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&free_list, &dentries[i].lru_elem);
+  lock_init (&dcache_lock);
+}
+
+/* Returns the dentry for NAME in directory DIR, or a null
+   pointer if there is none.  The caller must hold DCACHE_LOCK. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache_map, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Removes D from the cache and makes it free.  The caller must
+   hold DCACHE_LOCK. */
+static void
+discard (struct dentry *d)
+{
+  hash_delete (&dcache_map, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  list_push_back (&free_list, &d->lru_elem);
+}
+
+/* Looks up NAME in directory DIR.  On a positive hit, stores the
+   sector of NAME's inode in *SECTORP. */
+enum dcache_result
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp)
+{
+  enum dcache_result result = DCACHE_MISS;
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      if (d->negative)
+        {
+          result = DCACHE_NEGATIVE;
+          negative_cnt++;
+        }
+      else
+        {
+          result = DCACHE_POSITIVE;
+          *sectorp = d->sector;
+          hit_cnt++;
+        }
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+  return result;
+}
+
+/* Records that NAME in directory DIR refers to SECTOR if
+   NEGATIVE is false, or does not exist if it is true, replacing
+   any previous entry. */
+static void
+insert (block_sector_t dir, const char *name, bool negative,
+        block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      if (list_empty (&free_list))
+        discard (list_entry (list_back (&lru_list), struct dentry,
+                             lru_elem));
+      d = list_entry (list_pop_front (&free_list), struct dentry, lru_elem);
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache_map, &d->hash_elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+  list_push_front (&lru_list, &d->lru_elem);
+  d->negative = negative;
+  d->sector = sector;
+  lock_release (&dcache_lock);
+}
+
+/* Records that NAME in directory DIR refers to the inode at
+   SECTOR. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  insert (dir, name, false, sector);
+}
+
+/* Records that NAME does not exist in directory DIR. */
+void
+dcache_insert_negative (block_sector_t dir, const char *name)
+{
+  insert (dir, name, true, 0);
+}
+
+/* Forgets anything known about NAME in directory DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    discard (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets everything known about the directory whose inode is at
+   DIR. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru_list); e != list_end (&lru_list); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        discard (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dentry cache: %llu hits, %llu negative hits, %llu misses\n",
+          hit_cnt, negative_cnt, miss_cnt);
+}
+
+/* Returns a hash value for the dentry containing E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_int (d->dir) ^ hash_string (d->name);
+}
+
+/* Returns true if the dentry containing A precedes the one
+   containing B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -1,7 +1,9 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -13,9 +15,12 @@
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Current position (slot). */
   };
 
+/* Marks the end of a hash chain or of the free slot list. */
+#define DIR_NO_SLOT UINT32_MAX
+
 /* A single directory entry. */
 struct dir_entry 
   {
@@ -23,6 +28,35 @@ struct dir_entry
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
     bool isDirectory; //CHECK
+    uint32_t next;                      /* Next slot in chain (hashed). */
+  };
+
+/* A directory's entries live in numbered slots, and are stored in
+   one of two formats.
+
+   A small directory is a plain array of slots, searched linearly.
+
+   Once a linear directory needs more than DIR_LINEAR_MAX slots,
+   it is converted in place to the hashed format: a dir_header
+   followed by the same slots, in the same order.  The header
+   holds the heads of DIR_BUCKET_CNT hash chains, linked through
+   each entry's NEXT member, plus a list of free slots, so that
+   lookups, additions and removals touch one chain instead of the
+   whole directory.  Slots never move once converted, so
+   dir_readdir() positions, which are slot numbers, stay valid. */
+#define DIR_LINEAR_MAX 32
+#define DIR_HASH_MAGIC 0x44495248       /* "HRID"; not a valid sector. */
+#define DIR_HEADER_SIZE (4 * BLOCK_SECTOR_SIZE)
+#define DIR_BUCKET_CNT ((DIR_HEADER_SIZE - 3 * sizeof (uint32_t)) \
+                        / sizeof (uint32_t))
+
+/* Header of a hashed directory. */
+struct dir_header
+  {
+    uint32_t magic;                     /* DIR_HASH_MAGIC. */
+    uint32_t slot_cnt;                  /* Number of slots. */
+    uint32_t free_head;                 /* First free slot. */
+    uint32_t buckets[DIR_BUCKET_CNT];   /* First slot in each chain. */
   };
 
 static bool empty( struct inode * i); //CHECK
@@ -32,6 +66,9 @@ static bool empty( struct inode * i); //CHECK
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
+  /* Anything cached about a directory that used to live here is
+     stale. */
+  dcache_invalidate_dir (sector);
   return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -46,7 +83,7 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
-      dir->inode = inode;
+      dir->inode = inode_mark_metadata (inode);
       dir->pos = 0;
       return dir;
     }
@@ -99,32 +136,204 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Reads the 32-bit header field at byte offset OFS of hashed
+   directory INODE.  Returns 0 if the directory is too short to
+   contain it. */
+static uint32_t
+header_get (struct inode *inode, off_t ofs)
+{
+  uint32_t value = 0;
+  inode_read_at (inode, &value, sizeof value, ofs);
+  return value;
+}
+
+/* Sets the 32-bit header field at byte offset OFS of hashed
+   directory INODE to VALUE.  Returns true if successful. */
+static bool
+header_set (struct inode *inode, off_t ofs, uint32_t value)
+{
+  return inode_write_at (inode, &value, sizeof value, ofs) == sizeof value;
+}
+
+/* Returns the byte offset of the head of the hash chain for
+   NAME. */
+static off_t
+bucket_ofs (const char *name)
+{
+  return (offsetof (struct dir_header, buckets)
+          + hash_string (name) % DIR_BUCKET_CNT * sizeof (uint32_t));
+}
+
+/* Returns true if directory INODE is in the hashed format. */
+static bool
+is_hashed (struct inode *inode)
+{
+  return header_get (inode, offsetof (struct dir_header, magic))
+         == DIR_HASH_MAGIC;
+}
+
+/* Returns the byte offset of SLOT in a directory in the hashed
+   format if HASHED is true, or in the linear format otherwise. */
+static off_t
+slot_ofs (bool hashed, uint32_t slot)
+{
+  return (hashed ? DIR_HEADER_SIZE : 0) + slot * sizeof (struct dir_entry);
+}
+
+/* Reads SLOT of directory INODE into *E.
+   Returns false if the slot is past the end of the directory. */
+static bool
+read_slot (struct inode *inode, bool hashed, uint32_t slot,
+           struct dir_entry *e)
+{
+  return (inode_read_at (inode, e, sizeof *e, slot_ofs (hashed, slot))
+          == sizeof *e);
+}
+
+/* Writes *E to SLOT of directory INODE, extending the directory
+   if necessary.  Returns true if successful. */
+static bool
+write_slot (struct inode *inode, bool hashed, uint32_t slot,
+            const struct dir_entry *e)
+{
+  return (inode_write_at (inode, e, sizeof *e, slot_ofs (hashed, slot))
+          == sizeof *e);
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   if EP is non-null, sets *SLOTP to its slot if SLOTP is
+   non-null, and, for a hashed directory, sets *PREVP to the slot
+   that precedes it in its hash chain (or DIR_NO_SLOT if it is
+   first) if PREVP is non-null.
+   Otherwise, returns false and ignores EP, SLOTP and PREVP. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        struct dir_entry *ep, uint32_t *slotp, uint32_t *prevp) 
 {
   struct dir_entry e;
-  size_t ofs;
+  uint32_t slot, prev;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
+  if (!is_hashed (dir->inode))
+    {
+      for (slot = 0; read_slot (dir->inode, false, slot, &e); slot++)
+        if (e.in_use && !strcmp (name, e.name)) 
+          goto found;
+      return false;
+    }
+
+  /* Walk NAME's hash chain. */
+  prev = DIR_NO_SLOT;
+  for (slot = header_get (dir->inode, bucket_ofs (name));
+       slot != DIR_NO_SLOT && read_slot (dir->inode, true, slot, &e);
+       prev = slot, slot = e.next)
+    if (e.in_use && !strcmp (name, e.name))
       {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
+        if (prevp != NULL)
+          *prevp = prev;
+        goto found;
       }
   return false;
+
+ found:
+  if (ep != NULL)
+    *ep = e;
+  if (slotp != NULL)
+    *slotp = slot;
+  return true;
+}
+
+/* Converts linear directory INODE to the hashed format.
+   Returns true if successful, false on failure, in which case
+   the directory is unchanged. */
+static bool
+convert_to_hashed (struct inode *inode)
+{
+  off_t size = inode_length (inode);
+  uint32_t slot_cnt = size / sizeof (struct dir_entry);
+  struct dir_header *h;
+  struct dir_entry *entries;
+  bool success = false;
+  uint32_t i;
+
+  h = malloc (sizeof *h);
+  entries = malloc (slot_cnt * sizeof *entries);
+  if (h == NULL || entries == NULL)
+    goto done;
+  if (inode_read_at (inode, entries, slot_cnt * sizeof *entries, 0)
+      != (off_t) (slot_cnt * sizeof *entries))
+    goto done;
+
+  /* Thread every slot onto its hash chain or the free list.
+     Going backward keeps each chain in slot order. */
+  h->magic = DIR_HASH_MAGIC;
+  h->slot_cnt = slot_cnt;
+  h->free_head = DIR_NO_SLOT;
+  for (i = 0; i < DIR_BUCKET_CNT; i++)
+    h->buckets[i] = DIR_NO_SLOT;
+  for (i = slot_cnt; i-- > 0; )
+    {
+      struct dir_entry *e = &entries[i];
+      uint32_t *head = (e->in_use
+                        ? &h->buckets[hash_string (e->name) % DIR_BUCKET_CNT]
+                        : &h->free_head);
+      e->next = *head;
+      *head = i;
+    }
+
+  /* Entries first and the header, which switches the format, last.
+     If either write fails, cut the copied entries off again, or
+     the linear format would see them twice, and put back any
+     entries that part of the header overwrote.  (The linear
+     format ignores NEXT.)  The caller's journal transaction makes
+     the whole conversion atomic on disk. */
+  success = (inode_write_at (inode, entries, slot_cnt * sizeof *entries,
+                             DIR_HEADER_SIZE)
+             == (off_t) (slot_cnt * sizeof *entries))
+            && inode_write_at (inode, h, sizeof *h, 0) == sizeof *h;
+  if (!success
+      && (!inode_truncate (inode, size)
+          || (inode_write_at (inode, entries, slot_cnt * sizeof *entries, 0)
+              != (off_t) (slot_cnt * sizeof *entries))))
+    PANIC ("directory conversion could not be undone");
+
+ done:
+  free (entries);
+  free (h);
+  return success;
+}
+
+/* Like lookup(), but consults the dentry cache first and records
+   the outcome there on a miss.  On success, sets *SECTORP to the
+   sector of NAME's inode. */
+static bool
+cached_lookup (const struct dir *dir, const char *name,
+               block_sector_t *sectorp)
+{
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  struct dir_entry e;
+
+  switch (dcache_lookup (dir_sector, name, sectorp))
+    {
+    case DCACHE_POSITIVE:
+      return true;
+    case DCACHE_NEGATIVE:
+      return false;
+    case DCACHE_MISS:
+      break;
+    }
+
+  if (lookup (dir, name, &e, NULL, NULL))
+    {
+      dcache_insert (dir_sector, name, e.inode_sector);
+      *sectorp = e.inode_sector;
+      return true;
+    }
+  dcache_insert_negative (dir_sector, name);
+  return false;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -135,13 +344,13 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  if (cached_lookup (dir, name, &sector))
+    *inode = inode_open (sector);
   else
     *inode = NULL;
 
@@ -158,7 +367,9 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
-  off_t ofs;
+  block_sector_t existing;
+  uint32_t slot, head;
+  bool hashed;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -171,28 +382,75 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   //lockDirectory( dir->inode );
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (cached_lookup (dir, name, &existing))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  hashed = is_hashed (dir->inode);
+  if (!hashed)
+    {
+      /* Set SLOT to a free slot.
+         If there are no free slots, then it will be set to the
+         current end-of-file.
+         
+         inode_read_at() will only return a short read at end of file.
+         Otherwise, we'd need to verify that we didn't get a short
+         read due to something intermittent such as low memory. */
+      bool found = false;
+      for (slot = 0; read_slot (dir->inode, false, slot, &e); slot++)
+        if (!e.in_use)
+          {
+            found = true;
+            break;
+          }
+
+      if (found || slot < DIR_LINEAR_MAX)
+        {
+          /* Write slot. */
+          e.in_use = true;
+          strlcpy (e.name, name, sizeof e.name);
+          e.inode_sector = inode_sector;
+          e.next = DIR_NO_SLOT;
+          success = write_slot (dir->inode, false, slot, &e);
+          goto done;
+        }
+
+      /* The directory is full and too big to search linearly. */
+      if (!convert_to_hashed (dir->inode))
+        goto done;
+      hashed = true;
+    }
+
+  /* Take a slot off the free list, or add one at the end. */
+  slot = header_get (dir->inode, offsetof (struct dir_header, free_head));
+  if (slot != DIR_NO_SLOT)
+    {
+      if (!read_slot (dir->inode, true, slot, &e)
+          || !header_set (dir->inode,
+                          offsetof (struct dir_header, free_head), e.next))
+        goto done;
+    }
+  else
+    {
+      slot = header_get (dir->inode, offsetof (struct dir_header, slot_cnt));
+      if (!header_set (dir->inode, offsetof (struct dir_header, slot_cnt),
+                       slot + 1))
+        goto done;
+    }
 
-  /* Write slot. */
+  /* Write slot at the head of NAME's chain. */
+  head = header_get (dir->inode, bucket_ofs (name));
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  e.next = head;
+  success = (write_slot (dir->inode, true, slot, &e)
+             && header_set (dir->inode, bucket_ofs (name), slot));
 
  done:
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+  else
+    dcache_invalidate (inode_get_inumber (dir->inode), name);
   return success;
 }
 
@@ -205,30 +463,59 @@ dir_remove (struct dir *dir, const char *name)
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
+  bool hashed;
+  uint32_t slot, prev;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, &e, &slot, &prev))
     goto done;
+  hashed = is_hashed (dir->inode);
 
   /* Open inode. */
   inode = inode_open (e.inode_sector);
   if (inode == NULL)
     goto done;
 
+  if (hashed)
+    {
+      /* Unlink the entry from its chain. */
+      bool linked;
+      if (prev == DIR_NO_SLOT)
+        linked = header_set (dir->inode, bucket_ofs (name), e.next);
+      else
+        {
+          struct dir_entry p;
+          linked = read_slot (dir->inode, true, prev, &p);
+          p.next = e.next;
+          linked = linked && write_slot (dir->inode, true, prev, &p);
+        }
+      if (!linked)
+        goto done;
+
+      /* Put its slot on the free list. */
+      e.next = header_get (dir->inode,
+                           offsetof (struct dir_header, free_head));
+      if (!header_set (dir->inode, offsetof (struct dir_header, free_head),
+                       slot))
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  if (!write_slot (dir->inode, hashed, slot, &e))
     goto done;
 
-  /* Remove inode. */
+  /* Remove inode.  If it is a directory, whatever is cached about
+     its entries is now unreachable. */
   inode_remove (inode);
+  dcache_invalidate_dir (e.inode_sector);
   success = true;
 
  done:
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
   inode_close (inode);
   return success;
 }
@@ -238,12 +525,25 @@ dir_remove (struct dir *dir, const char *name)
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  block_sector_t sector;
+
+  return dir_readdir_sector (dir, name, &sector);
+}
+
+/* Like dir_readdir(), but also stores the sector of the entry's
+   inode into *SECTOR, so that a caller that wants the inode
+   need not look NAME up again. */
+bool
+dir_readdir_sector (struct dir *dir, char name[NAME_MAX + 1],
+                    block_sector_t *sector)
 {
   struct dir_entry e;
+  bool hashed = is_hashed (dir->inode);
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (read_slot (dir->inode, hashed, dir->pos, &e))
     {
-      dir->pos += sizeof e;
+      dir->pos++;
 
       // if ( e.in_use && strcmp(e.name, ".") && strcmp(e.name, "..")) {
 
@@ -254,6 +554,7 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
+          *sector = e.inode_sector;
           return true;
         } 
     }
@@ -265,9 +566,10 @@ static bool empty( struct inode * i ) {
   ASSERT( isDirectory(i) );
 
   struct dir_entry entry;
-  size_t offset;
+  bool hashed = is_hashed( i );
+  uint32_t slot;
 
-  for ( offset = 0; inode_read_at ( i, &entry, sizeof entry, offset) == sizeof entry; offset += sizeof entry ) {
+  for ( slot = 0; read_slot ( i, hashed, slot, &entry ); slot++ ) {
 
     if ( entry.in_use && strcmp(".", entry.name) && strcmp("..", entry.name) ) {
       
@@ -27,6 +27,8 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+bool dir_readdir_sector (struct dir *, char name[NAME_MAX + 1],
+                         block_sector_t *sector);
 
 
 off_t getPosition( struct dir *directory );
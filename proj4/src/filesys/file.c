@@ -1,14 +1,96 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "filesys/cache.h"
 #include "filesys/inode.h"
+#include "filesys/vfs.h"
 #include "threads/malloc.h"
 
+/* Bounds on the read-ahead window, in sectors. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 32
+
 /* An open file. */
 struct file 
   {
-    struct inode *inode;        /* File's inode. */
+    const struct vfs_file_ops *ops;     /* Operations on NODE. */
+    const struct vfs_dir_ops *dir_ops;  /* Null if not a directory. */
+    void *node;                 /* File's inode or other node. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of bytes already read ahead. */
+    int ra_window;              /* Read-ahead window in sectors. */
+  };
+
+static void update_readahead (struct file *, off_t start, off_t end);
+
+/* File operations on a disk inode. */
+static off_t
+inode_op_read_at (void *inode, void *buffer, off_t size, off_t offset)
+{
+  return inode_read_at (inode, buffer, size, offset);
+}
+
+static off_t
+inode_op_write_at (void *inode, const void *buffer, off_t size, off_t offset)
+{
+  return inode_write_at (inode, buffer, size, offset);
+}
+
+static off_t
+inode_op_length (void *inode)
+{
+  return inode_length (inode);
+}
+
+static bool
+inode_op_allocate (void *inode, off_t offset, off_t size)
+{
+  return inode_allocate (inode, offset, size);
+}
+
+static bool
+inode_op_truncate (void *inode, off_t length)
+{
+  return inode_truncate (inode, length);
+}
+
+static void
+inode_op_readahead (void *inode, off_t offset, off_t size)
+{
+  inode_readahead (inode, offset, size);
+}
+
+static void
+inode_op_deny_write (void *inode)
+{
+  inode_deny_write (inode);
+}
+
+static void
+inode_op_allow_write (void *inode)
+{
+  inode_allow_write (inode);
+}
+
+static void *
+inode_op_reopen (void *inode)
+{
+  return inode_reopen (inode);
+}
+
+static void
+inode_op_close (void *inode)
+{
+  inode_close (inode);
+}
+
+static const struct vfs_file_ops inode_file_ops =
+  {
+    inode_op_read_at, inode_op_write_at, inode_op_length,
+    inode_op_allocate, inode_op_truncate, inode_op_readahead,
+    inode_op_deny_write, inode_op_allow_write, inode_op_reopen,
+    inode_op_close,
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -16,18 +98,43 @@ struct file
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
+{
+  return file_open_node (&inode_file_ops, NULL, inode);
+}
+
+/* Like file_open(), but for directory INODE, which DIR_OPS
+   reads. */
+struct file *
+file_open_dir (struct inode *inode, const struct vfs_dir_ops *dir_ops)
+{
+  return file_open_node (&inode_file_ops, dir_ops, inode);
+}
+
+/* Opens a file for NODE, of which it takes ownership, whose data
+   OPS operates on and, if NODE is a directory, whose entries
+   DIR_OPS reads, and returns the new file.  Returns a null pointer
+   if an allocation fails or if NODE is null. */
+struct file *
+file_open_node (const struct vfs_file_ops *ops,
+                const struct vfs_dir_ops *dir_ops, void *node)
 {
   struct file *file = calloc (1, sizeof *file);
-  if (inode != NULL && file != NULL)
+  if (node != NULL && file != NULL)
     {
-      file->inode = inode;
+      file->ops = ops;
+      file->dir_ops = dir_ops;
+      file->node = node;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
     {
-      inode_close (inode);
+      if (node != NULL)
+        ops->close (node);
       free (file);
       return NULL; 
     }
@@ -38,7 +145,8 @@ file_open (struct inode *inode)
 struct file *
 file_reopen (struct file *file) 
 {
-  return file_open (inode_reopen (file->inode));
+  return file_open_node (file->ops, file->dir_ops,
+                         file->ops->reopen (file->node));
 }
 
 /* Closes FILE. */
@@ -48,16 +156,37 @@ file_close (struct file *file)
   if (file != NULL)
     {
       file_allow_write (file);
-      inode_close (file->inode);
+      file->ops->close (file->node);
       free (file); 
     }
 }
 
-/* Returns the inode encapsulated by FILE. */
+/* Returns the inode encapsulated by FILE, or a null pointer if
+   FILE is not on the disk. */
 struct inode *
 file_get_inode (struct file *file) 
 {
-  return file->inode;
+  return file->ops == &inode_file_ops ? file->node : NULL;
+}
+
+/* Returns true if FILE is a directory. */
+bool
+file_is_dir (struct file *file)
+{
+  return file->dir_ops != NULL;
+}
+
+/* Reads up to CNT entries of directory FILE, starting at the
+   file's current position, into ENTRIES and advances the position
+   past them.  Returns the number of entries read, 0 at the end of
+   the directory or if FILE is not a directory. */
+size_t
+file_readdir (struct file *file, struct vfs_dirent entries[], size_t cnt)
+{
+  ASSERT (file != NULL);
+  if (file->dir_ops == NULL)
+    return 0;
+  return file->dir_ops->readdir (file->node, &file->pos, entries, cnt);
 }
 
 /* Reads SIZE bytes from FILE into BUFFER,
@@ -68,7 +197,8 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = file->ops->read_at (file->node, buffer, size, file->pos);
+  update_readahead (file, file->pos, file->pos + bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,36 +211,34 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  return file->ops->read_at (file->node, buffer, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
+   Writing past end of file extends the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written = file->ops->write_at (file->node, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
+   Writing past end of file extends the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
                off_t file_ofs) 
 {
-  return inode_write_at (file->inode, buffer, size, file_ofs);
+  return file->ops->write_at (file->node, buffer, size, file_ofs);
 }
 
 /* Prevents write operations on FILE's underlying inode
@@ -122,7 +250,7 @@ file_deny_write (struct file *file)
   if (!file->deny_write) 
     {
       file->deny_write = true;
-      inode_deny_write (file->inode);
+      file->ops->deny_write (file->node);
     }
 }
 
@@ -136,7 +264,7 @@ file_allow_write (struct file *file)
   if (file->deny_write) 
     {
       file->deny_write = false;
-      inode_allow_write (file->inode);
+      file->ops->allow_write (file->node);
     }
 }
 
@@ -145,7 +273,29 @@ off_t
 file_length (struct file *file) 
 {
   ASSERT (file != NULL);
-  return inode_length (file->inode);
+  return file->ops->length (file->node);
+}
+
+/* Allocates disk space for the SIZE bytes of FILE starting at
+   OFFSET, extending FILE if it is shorter than OFFSET + SIZE
+   bytes.  The file position is unaffected.
+   Returns true if successful, false otherwise. */
+bool
+file_allocate (struct file *file, off_t offset, off_t size)
+{
+  ASSERT (file != NULL);
+  return file->ops->allocate (file->node, offset, size);
+}
+
+/* Sets the size of FILE to LENGTH bytes, discarding data past
+   LENGTH or extending FILE with zeros.  The file position is
+   unaffected.
+   Returns true if successful, false otherwise. */
+bool
+file_truncate (struct file *file, off_t length)
+{
+  ASSERT (file != NULL);
+  return file->ops->truncate (file->node, length);
 }
 
 /* Sets the current position in FILE to NEW_POS bytes from the
@@ -166,3 +316,42 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Updates FILE's read-ahead state after a read of bytes START
+   through END.  A read that begins where the previous one ended
+   is sequential and doubles the read-ahead window, up to
+   READAHEAD_MAX sectors; any other read closes the window.  The
+   sectors in the window beyond END that have not been requested
+   yet are handed to the buffer cache's read-ahead thread. */
+static void
+update_readahead (struct file *file, off_t start, off_t end)
+{
+  int max_window = cache_capacity () / 4;
+  off_t ra_start, ra_limit;
+
+  if (file->ops->readahead == NULL)
+    return;
+  if (start != file->ra_next || end == start)
+    {
+      file->ra_window = 0;
+      file->ra_end = end;
+      file->ra_next = end;
+      return;
+    }
+  file->ra_next = end;
+
+  if (file->ra_window == 0)
+    file->ra_window = READAHEAD_MIN;
+  else if (file->ra_window < READAHEAD_MAX)
+    file->ra_window *= 2;
+  if (file->ra_window > max_window)
+    file->ra_window = max_window;
+
+  ra_start = file->ra_end > end ? file->ra_end : end;
+  ra_limit = end + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (ra_start < ra_limit)
+    {
+      file->ops->readahead (file->node, ra_start, ra_limit - ra_start);
+      file->ra_end = ra_limit;
+    }
+}
@@ -1,16 +1,28 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 
 struct inode;
+struct vfs_file_ops;
+struct vfs_dir_ops;
+struct vfs_dirent;
 
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
+struct file *file_open_dir (struct inode *, const struct vfs_dir_ops *);
+struct file *file_open_node (const struct vfs_file_ops *,
+                             const struct vfs_dir_ops *, void *node);
 struct file *file_reopen (struct file *);
 void file_close (struct file *);
 struct inode *file_get_inode (struct file *);
 
+/* Directories. */
+bool file_is_dir (struct file *);
+size_t file_readdir (struct file *, struct vfs_dirent *, size_t cnt);
+
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
@@ -26,4 +38,8 @@ void file_seek (struct file *, off_t);
 off_t file_tell (struct file *);
 off_t file_length (struct file *);
 
+/* Changing file size. */
+bool file_allocate (struct file *, off_t offset, off_t size);
+bool file_truncate (struct file *, off_t length);
+
 #endif /* filesys/file.h */
@@ -1,36 +1,205 @@
 #include "filesys/filesys.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/initramfs.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/tmpfs.h"
+#include "filesys/vfs.h"
 #include "filesys/directory.h"
 #include "filesys/directory.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Sectors per file system block. */
+unsigned fs_block_sectors = 1;
+
+/* Sectors per block for a file system formatted by -f. */
+static unsigned format_block_sectors = 1;
+
+/* Log-structured layout. */
+bool fs_log;
+static bool format_log;                 /* Format with -f as log? */
+static block_sector_t checkpoint_head;  /* Log head in the superblock. */
+
+/* How often the cleaner thread checks whether it needs to run,
+   and how few clean segments make it do so. */
+#define CLEAN_INTERVAL TIMER_FREQ
+#define CLEAN_MIN_SEGMENTS 4
+
+/* Stopping the cleaner thread at shutdown. */
+static bool cleaner_stop;               /* Should the cleaner exit? */
+static struct semaphore cleaner_done;   /* Upped when it has. */
+
+/* Identifies a superblock. */
+#define SUPER_MAGIC 0x53555052
+
+/* File system layouts. */
+#define LAYOUT_IN_PLACE 0               /* Data stays where allocated. */
+#define LAYOUT_LOG 1                    /* Data is appended to a log. */
+
+/* Superblock, in SUPER_SECTOR.  Records the parameters the file
+   system was formatted with and, for a log-structured file
+   system, serves as the checkpoint region: the log head as of the
+   last checkpoint.  Replaying the journal makes the free map and
+   inodes consistent without it, so a stale log head only costs a
+   less sequential layout until the head reaches a clean segment.
+   It also records the head of the orphan list, the removed inodes
+   whose sectors are not yet free (see inode_remove()).
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct superblock
+  {
+    unsigned magic;                     /* SUPER_MAGIC. */
+    uint32_t block_sectors;             /* Sectors per block. */
+    uint32_t layout;                    /* LAYOUT_IN_PLACE or LAYOUT_LOG. */
+    uint32_t log_head;                  /* Log head sector at checkpoint. */
+    uint32_t orphan_head;               /* First orphaned inode, or 0. */
+    uint32_t unused[123];               /* Not used. */
+  };
+
+/* Superblock contents not kept elsewhere. */
+static block_sector_t orphan_head;      /* First orphaned inode, or 0. */
+static struct lock super_lock;          /* Serializes write_super(). */
+
+/* Where to mount a tmpfs, if anywhere. */
+static const char *tmpfs_point;
+
+/* Is the disk's file system mounted?  It is not when the kernel
+   boots from an initial RAM file system. */
+static bool disk_mounted;
+
+static void mount_disk (bool format);
 static void do_format (void);
+static bool create (const char *name, off_t initial_size, bool compressed);
+static bool on_disk (const char *name);
+static bool disk_create (void *fs, const char *name, off_t initial_size);
+static struct file *disk_open (void *fs, const char *name);
+static bool disk_remove (void *fs, const char *name);
+static size_t disk_readdir (void *inode, off_t *pos,
+                            struct vfs_dirent entries[], size_t cnt);
+
+/* Operations on the disk's names, and on its root directory. */
+static const struct vfs_inode_ops disk_inode_ops =
+  {
+    disk_create, disk_open, disk_remove,
+  };
+static const struct vfs_dir_ops disk_dir_ops =
+  {
+    disk_readdir,
+  };
+static void cleaner_daemon (void *aux);
+static void defrag_inode (struct inode *, struct frag_stats *before,
+                          struct frag_stats *after);
+static void read_super (void);
+static void write_super (void);
+static void read_orphans (void);
+
+/* Sets the block size, in bytes, of a file system formatted with
+   -f to BLOCK_SIZE, which must be a power of two between
+   BLOCK_SECTOR_SIZE and FS_BLOCK_SECTORS_MAX sectors.  Must be
+   called before filesys_init(). */
+void
+filesys_configure (unsigned block_size)
+{
+  unsigned sectors = block_size / BLOCK_SECTOR_SIZE;
+
+  if (block_size % BLOCK_SECTOR_SIZE != 0 || sectors == 0
+      || sectors > FS_BLOCK_SECTORS_MAX || (sectors & (sectors - 1)) != 0)
+    PANIC ("invalid file system block size %u", block_size);
+  format_block_sectors = sectors;
+}
+
+/* Makes a file system formatted with -f log-structured.  Must be
+   called before filesys_init(). */
+void
+filesys_configure_log (void)
+{
+  format_log = true;
+}
+
+/* Mounts a tmpfs at POINT, a name in the root directory, when the
+   file system is initialized.  Must be called before
+   filesys_init(). */
+void
+filesys_configure_tmpfs (const char *point)
+{
+  tmpfs_point = point;
+}
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If the kernel has an initial RAM file system, its root is a
+   tmpfs holding the archive's files and the disk is left alone.
+   Otherwise, its root is the disk's file system, which is first
+   reformatted if FORMAT is true. */
 void
 filesys_init (bool format) 
+{
+  if (initramfs_present ())
+    initramfs_mount ();
+  else
+    mount_disk (format);
+
+  if (tmpfs_point != NULL && !tmpfs_mount (tmpfs_point, TMPFS_MAX_PAGES))
+    PANIC ("can't mount tmpfs at %s", tmpfs_point);
+}
+
+/* Mounts the disk's file system at the root, reformatting it
+   first if FORMAT is true. */
+static void
+mount_disk (bool format)
 {
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  /* Everything below works in blocks, so learn their size
+     first. */
+  if (format)
+    {
+      fs_block_sectors = format_block_sectors;
+      fs_log = format_log;
+    }
+  else
+    read_super ();
+
+  cache_init ();
+  dcache_init ();
   inode_init ();
   free_map_init ();
+  lock_init (&super_lock);
+  orphan_head = 0;
 
   if (format) 
     do_format ();
 
+  journal_init ();
+  read_orphans ();
   free_map_open ();
+  if (fs_log)
+    {
+      free_map_seek_log (checkpoint_head);
+      cleaner_stop = false;
+      sema_init (&cleaner_done, 0);
+      thread_create ("cleaner", PRI_DEFAULT, cleaner_daemon, NULL);
+    }
+  cache_start_flusher ();
+  inode_start_writeback ();
+  inode_start_reclaim ();
+  inode_reclaim_orphans (orphan_head);
+
+  vfs_mount ("/", &disk_inode_ops, NULL);
+  disk_mounted = true;
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -38,7 +207,21 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  if (!disk_mounted)
+    return;
+
+  while (inode_writeback () > 0)
+    continue;
+  inode_reclaim ();
+  if (fs_log)
+    {
+      cleaner_stop = true;
+      sema_down (&cleaner_done);
+      write_super ();
+    }
   free_map_close ();
+  journal_done ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -47,12 +230,51 @@ filesys_done (void)
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) 
+{
+  const char *rest;
+  const struct vfs_mount *m = vfs_resolve (name, &rest);
+
+  return m != NULL && m->ops->create (m->fs, rest, initial_size);
+}
+
+/* Like filesys_create(), but the new file's data is stored
+   compressed.  Fails if NAME is not on the disk. */
+bool
+filesys_create_compressed (const char *name, off_t initial_size)
+{
+  return on_disk (name) && create (name, initial_size, true);
+}
+
+/* Returns true if NAME lies in the disk's file system rather than
+   in another one mounted on it. */
+static bool
+on_disk (const char *name)
+{
+  const char *rest;
+  const struct vfs_mount *m = vfs_resolve (name, &rest);
+
+  return m != NULL && m->ops == &disk_inode_ops;
+}
+
+/* Creates a file named NAME on the disk with the given
+   INITIAL_SIZE. */
+static bool
+disk_create (void *fs UNUSED, const char *name, off_t initial_size)
+{
+  return create (name, initial_size, false);
+}
+
+/* Creates a file named NAME with the given INITIAL_SIZE, whose
+   data is stored compressed if COMPRESSED is true.
+   Returns true if successful, false otherwise. */
+static bool
+create (const char *name, off_t initial_size, bool compressed)
 {
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_root ();
 
-  char *fileName;
   if ( strcmp(name, "/") == false ) {
+    dir_close( dir );
     return false;
   }
 
@@ -62,15 +284,24 @@ filesys_create (const char *name, off_t initial_size)
 
   // }
 
+  /* Put the new inode near its directory's inode. */
+  block_sector_t goal = (dir != NULL
+                         ? inode_get_inumber (dir_get_inode (dir)) : 0);
+
+  journal_begin ();
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
+                  && free_map_allocate_near (1, goal, &inode_sector)
+                  && (compressed
+                      ? inode_create_compressed (inode_sector, initial_size)
+                      : inode_create (inode_sector, initial_size))
                   && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
+    {
+      journal_revoke (inode_sector, 1);
+      free_map_release (inode_sector, 1);
+    }
   dir_close (dir);
-
-  free( fileName );
+  journal_end ();
 
   return success;
 }
@@ -82,13 +313,23 @@ filesys_create (const char *name, off_t initial_size)
    or if an internal memory allocation fails. */
 struct file *
 filesys_open (const char *name)
+{
+  const char *rest;
+  const struct vfs_mount *m = vfs_resolve (name, &rest);
+
+  return m != NULL ? m->ops->open (m->fs, rest) : NULL;
+}
+
+/* Opens the file on the disk with the given NAME. */
+static struct file *
+disk_open (void *fs UNUSED, const char *name)
 {
   struct dir *dir = dir_open_root ();
   struct inode *inode = NULL;
 
-  char *fileName;
   if ( strcmp(name, "/") == false ) {
-    return false;
+    dir_close( dir );
+    return NULL;
   }
 
   // if ( !parse(name, &dir, &fileName) ) {
@@ -101,22 +342,123 @@ filesys_open (const char *name)
     dir_lookup (dir, name, &inode);
   dir_close (dir);
 
-  free( fileName );
-
+  /* The root directory is the only directory this file system
+     has. */
+  if (inode != NULL && inode_get_inumber (inode) == ROOT_DIR_SECTOR)
+    return file_open_dir (inode, &disk_dir_ops);
   return file_open (inode);
 }
 
+/* Reads up to CNT entries of the disk directory INODE into
+   ENTRIES, starting at *POS, skipping "." and "..".  Each entry's
+   inode is opened by the sector its directory entry names, which
+   finds it in the open inode table if it is already loaded,
+   instead of looking its name up again. */
+static size_t
+disk_readdir (void *inode, off_t *pos, struct vfs_dirent entries[],
+              size_t cnt)
+{
+  struct dir *dir = dir_open (inode_reopen (inode));
+  char name[NAME_MAX + 1];
+  block_sector_t sector;
+  size_t n = 0;
+
+  if (dir == NULL)
+    return 0;
+  setPosition (dir, *pos);
+  while (n < cnt && dir_readdir_sector (dir, name, &sector))
+    {
+      struct vfs_dirent *e;
+      struct inode *entry;
+
+      if (!strcmp (name, ".") || !strcmp (name, ".."))
+        continue;
+      e = &entries[n++];
+      entry = inode_open (sector);
+      strlcpy (e->name, name, sizeof e->name);
+      e->is_dir = sector == ROOT_DIR_SECTOR;
+      e->inumber = sector;
+      e->size = entry != NULL ? inode_length (entry) : 0;
+      inode_close (entry);
+    }
+  *pos = getPosition (dir);
+  dir_close (dir);
+  return n;
+}
+
+/* Creates a file named NAME that is a copy of SRC, sharing SRC's
+   data sectors until either file writes them, so that the copy
+   costs the same however large SRC is.
+   Returns true if successful, false otherwise.
+   Fails if SRC is a directory, if SRC or NAME is not on the disk,
+   if a file named NAME already exists, or if the disk or memory
+   is exhausted. */
+bool
+filesys_clone (struct file *src, const char *name)
+{
+  block_sector_t inode_sector = 0;
+  struct inode *inode = file_get_inode (src);
+  struct inode *clone = NULL;
+  struct dir *dir = dir_open_root ();
+
+  if (strcmp (name, "/") == 0 || inode == NULL || !on_disk (name)
+      || inode_get_inumber (inode) == ROOT_DIR_SECTOR)
+    {
+      dir_close (dir);
+      return false;
+    }
+
+  /* Put the new inode near its directory's inode. */
+  block_sector_t goal = (dir != NULL
+                         ? inode_get_inumber (dir_get_inode (dir)) : 0);
+
+  journal_begin ();
+  bool success = (dir != NULL
+                  && free_map_allocate_near (1, goal, &inode_sector)
+                  && inode_create (inode_sector, 0)
+                  && (clone = inode_open (inode_sector)) != NULL
+                  && inode_clone (inode, clone)
+                  && dir_add (dir, name, inode_sector));
+  if (!success && clone != NULL)
+    {
+      /* Removing the clone drops the references it took, and frees
+         its sector too. */
+      inode_remove (clone);
+      inode_sector = 0;
+    }
+  inode_close (clone);
+  if (!success && inode_sector != 0)
+    {
+      journal_revoke (inode_sector, 1);
+      free_map_release (inode_sector, 1);
+    }
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
+{
+  const char *rest;
+  const struct vfs_mount *m = vfs_resolve (name, &rest);
+
+  return m != NULL && m->ops->remove (m->fs, rest);
+}
+
+/* Deletes the file on the disk named NAME. */
+static bool
+disk_remove (void *fs UNUSED, const char *name)
 {
   struct dir *dir = dir_open_root ();
 
-  char *fileName;
   if ( strcmp(name, "/") == false ) {
+    dir_close( dir );
     return false;
   }
 
@@ -126,26 +468,142 @@ filesys_remove (const char *name)
 
   // }
 
-  if ( !strcmp(fileName, ".") || !strcmp(fileName, "..") ) {
+  if ( !strcmp(name, ".") || !strcmp(name, "..") ) {
 
     dir_close( dir );
-    free( fileName );
     return false;
 
   }
+  journal_begin ();
   bool success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
-
-  free( fileName );
+  journal_end ();
 
   return success;
 }
 
+/* Moves the data of the root directory and of every fragmented
+   file in it into a single run of consecutive sectors, while the
+   file system stays in use.  Stores the fragmentation found into
+   *BEFORE and the fragmentation left afterward into *AFTER.  A
+   file stays fragmented if no free run is long enough to hold a
+   second copy of it.  Finds nothing to do if the disk is not
+   mounted. */
+void
+filesys_defrag (struct frag_stats *before, struct frag_stats *after)
+{
+  struct dir *dir;
+  char name[NAME_MAX + 1];
+
+  memset (before, 0, sizeof *before);
+  memset (after, 0, sizeof *after);
+  if (!disk_mounted)
+    return;
+  dir = dir_open_root ();
+  if (dir == NULL)
+    return;
+
+  defrag_inode (dir_get_inode (dir), before, after);
+  while (dir_readdir (dir, name))
+    {
+      struct inode *inode;
+
+      if (strcmp (name, ".") && strcmp (name, "..")
+          && dir_lookup (dir, name, &inode))
+        {
+          defrag_inode (inode, before, after);
+          inode_close (inode);
+        }
+    }
+  dir_close (dir);
+}
+
+/* Defragments INODE, adding its fragmentation to *BEFORE and
+   *AFTER. */
+static void
+defrag_inode (struct inode *inode, struct frag_stats *before,
+              struct frag_stats *after)
+{
+  size_t runs = inode_runs (inode);
+
+  before->files++;
+  before->runs += runs;
+  if (runs > 1)
+    {
+      before->fragmented++;
+      if (inode_defrag (inode))
+        {
+          after->moved++;
+          runs = inode_runs (inode);
+        }
+    }
+  after->files++;
+  after->runs += runs;
+  if (runs > 1)
+    after->fragmented++;
+}
+
+/* Moves the blocks of the root directory and of every file in it
+   that lie in the CNT sectors starting at START to the log head,
+   so that the cleaner can reuse them as a clean segment. */
+static void
+clean_segment (block_sector_t start, size_t cnt)
+{
+  struct dir *dir = dir_open_root ();
+  char name[NAME_MAX + 1];
+
+  if (dir == NULL)
+    return;
+  inode_evacuate (dir_get_inode (dir), start, cnt);
+  while (dir_readdir (dir, name))
+    {
+      struct inode *inode;
+
+      if (strcmp (name, ".") && strcmp (name, "..")
+          && dir_lookup (dir, name, &inode))
+        {
+          inode_evacuate (inode, start, cnt);
+          inode_close (inode);
+        }
+    }
+  dir_close (dir);
+}
+
+/* Cleaner thread for a log-structured file system.  Whenever
+   clean segments run low, empties the least used segment.  Also
+   writes a checkpoint whenever the log head has moved since the
+   last one.  Directories have no locks of their own, so it holds
+   the file system lock while walking the root directory.  Exits
+   once filesys_done() sets CLEANER_STOP. */
+static void
+cleaner_daemon (void *aux UNUSED)
+{
+  while (!cleaner_stop)
+    {
+      block_sector_t start;
+      size_t cnt;
+
+      timer_sleep (CLEAN_INTERVAL);
+      if (free_map_clean_segments () < CLEAN_MIN_SEGMENTS
+          && free_map_pick_victim (&start, &cnt))
+        {
+          acquireFilesysLock ();
+          clean_segment (start, cnt);
+          releaseFilesysLock ();
+        }
+      if (free_map_log_head () != checkpoint_head)
+        write_super ();
+    }
+  sema_up (&cleaner_done);
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  write_super ();
+  journal_format ();
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
@@ -161,6 +619,78 @@ do_format (void)
   printf ("done.\n");
 }
 
+/* Reads the superblock and sets fs_block_sectors from it. */
+static void
+read_super (void)
+{
+  struct superblock *sb = malloc (sizeof *sb);
+
+  ASSERT (sizeof *sb == BLOCK_SECTOR_SIZE);
+  if (sb == NULL)
+    PANIC ("superblock allocation failed");
+  block_read (fs_device, SUPER_SECTOR, sb);
+  if (sb->magic != SUPER_MAGIC)
+    PANIC ("no superblock found--file system must be formatted");
+  if (sb->block_sectors == 0 || sb->block_sectors > FS_BLOCK_SECTORS_MAX
+      || (sb->block_sectors & (sb->block_sectors - 1)) != 0)
+    PANIC ("superblock has bad block size %"PRIu32, sb->block_sectors);
+  if (sb->layout != LAYOUT_IN_PLACE && sb->layout != LAYOUT_LOG)
+    PANIC ("superblock has unknown layout %"PRIu32, sb->layout);
+  fs_block_sectors = sb->block_sectors;
+  fs_log = sb->layout == LAYOUT_LOG;
+  checkpoint_head = sb->log_head;
+  free (sb);
+}
+
+/* Writes a superblock for fs_block_sectors and fs_log, with the
+   current log head as the checkpoint.  SUPER_SECTOR may share a
+   block with other metadata, so the write goes through the
+   journal and the buffer cache, like theirs. */
+static void
+write_super (void)
+{
+  struct superblock *sb = calloc (1, sizeof *sb);
+
+  if (sb == NULL)
+    PANIC ("superblock allocation failed");
+  lock_acquire (&super_lock);
+  checkpoint_head = fs_log ? free_map_log_head () : 0;
+  sb->magic = SUPER_MAGIC;
+  sb->block_sectors = fs_block_sectors;
+  sb->layout = fs_log ? LAYOUT_LOG : LAYOUT_IN_PLACE;
+  sb->log_head = checkpoint_head;
+  sb->orphan_head = orphan_head;
+  journal_write (SUPER_SECTOR, sb);
+  lock_release (&super_lock);
+  free (sb);
+}
+
+/* Reads the head of the orphan list from the superblock, as left
+   by replaying the journal. */
+static void
+read_orphans (void)
+{
+  struct superblock *sb = malloc (sizeof *sb);
+
+  if (sb == NULL)
+    PANIC ("superblock allocation failed");
+  cache_read (SUPER_SECTOR, sb);
+  orphan_head = sb->orphan_head;
+  free (sb);
+}
+
+/* Records SECTOR, or 0 if none, as the first inode on the orphan
+   list, in the superblock.  The caller is responsible for the
+   list's consistency. */
+void
+filesys_set_orphans (block_sector_t sector)
+{
+  lock_acquire (&super_lock);
+  orphan_head = sector;
+  lock_release (&super_lock);
+  write_super ();
+}
+
 // bool parse(const char *filePath, struct dir **directory, char **fileName) {
 
 //   *fileName = NULL;
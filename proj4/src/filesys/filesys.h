@@ -3,21 +3,55 @@
 
 #include <stdbool.h>
 #include "filesys/off_t.h"
+#include "devices/block.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define SUPER_SECTOR 2          /* Superblock sector. */
+#define REFCOUNT_SECTOR 3       /* Block reference count file inode sector. */
+#define JOURNAL_SECTOR 8        /* Start of journal region. */
+
+/* Most sectors in a file system block. */
+#define FS_BLOCK_SECTORS_MAX 8
 
 /* Block device that contains the file system. */
 struct block *fs_device;
 
+/* Sectors per file system block.  Disk space is allocated, cached
+   and transferred in blocks of this many consecutive sectors,
+   starting at a multiple of it. */
+extern unsigned fs_block_sectors;
+
+/* True if the file system is log-structured: new and rewritten
+   data is appended at the log head instead of being placed near
+   its inode or overwritten in place. */
+extern bool fs_log;
+
+void filesys_configure (unsigned block_size);
+void filesys_configure_log (void);
+void filesys_configure_tmpfs (const char *point);
+
+/* Fragmentation statistics, as gathered by filesys_defrag(). */
+struct frag_stats
+  {
+    unsigned files;             /* Files and directories examined. */
+    unsigned fragmented;        /* Those with more than one run. */
+    unsigned runs;              /* Total runs of consecutive sectors. */
+    unsigned moved;             /* Those relocated into one run. */
+  };
+
 //struct dir;
 
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
+bool filesys_create_compressed (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
+bool filesys_clone (struct file *src, const char *name);
 bool filesys_remove (const char *name);
+void filesys_defrag (struct frag_stats *before, struct frag_stats *after);
+void filesys_set_orphans (block_sector_t);
 
 //bool parse(const char *filePath, struct dir **directory, char **fileName );
 
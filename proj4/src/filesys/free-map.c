@@ -1,85 +1,770 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
+/* The free map tracks file system blocks of fs_block_sectors
+   sectors each, but its interface is in sectors: allocations are
+   rounded up to whole blocks, and releasing any sector of a block
+   releases the whole block. */
 static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *free_map;      /* Free map, one bit per block. */
+
+/* Serializes allocations and releases, which may come from the
+   inode writeback thread as well as from system calls. */
+static struct lock free_map_lock;
+
+/* Number of free map bits stored in one sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Sectors of the free map file whose bits have changed since they
+   were last written, one bit per free map file sector.  Only
+   these are written back, so that an allocation costs one sector
+   write instead of a rewrite of the whole free map. */
+static struct bitmap *dirty_map;
+
+/* A block may be shared by several files, once one has been
+   cloned from another.  REFS holds one count per block of the
+   references to it beyond the first, so that a block used by a
+   single file, as most are, counts zero.  Releasing a block whose
+   count is nonzero only decrements the count.  The counts are
+   kept in the reference count file, which is written back a
+   sector at a time like the free map. */
+static struct file *refs_file;       /* Reference count file. */
+static uint8_t *refs;                /* Extra references, per block. */
+static struct bitmap *refs_dirty;    /* Dirty sectors of REFS_FILE. */
+static size_t shared_cnt;            /* Blocks with a nonzero count. */
+
+/* The disk is divided into allocation groups of GROUP_BLOCKS
+   blocks.  Each group tracks how many of its blocks are free
+   and, when known, the length of its longest free run, so that
+   an allocation can skip groups that cannot satisfy it without
+   scanning their bits.  Allocations start in the group that
+   contains the caller's goal sector, which keeps a file's data
+   close to its inode and directory. */
+#define GROUP_BLOCKS 1024
+
+/* An allocation group. */
+struct alloc_group
+  {
+    size_t free_cnt;                 /* Number of free blocks. */
+    size_t longest;                  /* Longest free run, if LONGEST_VALID. */
+    bool longest_valid;              /* False if LONGEST may be stale. */
+  };
+
+static struct alloc_group *groups;   /* Array of GROUP_CNT groups. */
+static size_t group_cnt;             /* Number of allocation groups. */
+static size_t total_free;            /* Free blocks in all groups. */
+
+/* Blocks promised to delayed allocations by free_map_reserve().
+   Other allocations must leave this many blocks free, so that
+   delayed data written while the disk had room can always be
+   allocated later. */
+static size_t reserved_cnt;
+
+/* In a log-structured file system, allocations ignore their goal
+   and are instead appended at the log head, so that the buffer
+   cache writes new and rewritten data sequentially.  The disk is
+   divided into segments of LOG_SEGMENT_SECTORS sectors.  When the
+   head reaches the end of its segment, it moves to the next clean
+   (entirely free) segment, which the cleaner thread keeps in
+   supply; if there are none, allocations fall back to the first
+   free run after the head. */
+#define LOG_SEGMENT_SECTORS 64
+static size_t log_head;              /* Next block to allocate. */
+
+static size_t segment_blocks (void);
+static size_t allocate_log (size_t cnt);
+
+static void clear (block_sector_t sector, size_t cnt);
+static void mark_dirty (size_t block, size_t cnt);
+static void mark_refs_dirty (size_t block);
+static void init_groups (void);
+static void update_groups (size_t block, size_t cnt, bool allocated);
+static size_t allocate_in_group (size_t group, size_t cnt, size_t goal);
+static bool allocate (size_t cnt, block_sector_t goal,
+                      block_sector_t *sectorp, size_t *reserved);
+
+/* Marks the blocks that contain the CNT sectors starting at
+   SECTOR as in use. */
+static void
+reserve (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / fs_block_sectors;
+  size_t last = (sector + cnt - 1) / fs_block_sectors;
+
+  bitmap_set_multiple (free_map, first, last - first + 1, true);
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
+  free_map = bitmap_create (block_size (fs_device) / fs_block_sectors);
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  refs = calloc (bitmap_size (free_map), sizeof *refs);
+  refs_dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                            BLOCK_SECTOR_SIZE));
+  if (refs == NULL || refs_dirty == NULL)
+    PANIC ("reference count creation failed");
+  shared_cnt = 0;
+  reserved_cnt = 0;
+  lock_init (&free_map_lock);
+  if (bitmap_size (free_map) * fs_block_sectors
+      < JOURNAL_SECTOR + JOURNAL_SECTORS + fs_block_sectors)
+    PANIC ("file system device is too small for the journal");
+  reserve (FREE_MAP_SECTOR, 1);
+  reserve (ROOT_DIR_SECTOR, 1);
+  reserve (SUPER_SECTOR, 1);
+  reserve (REFCOUNT_SECTOR, 1);
+  reserve (JOURNAL_SECTOR, JOURNAL_SECTORS);
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_BLOCKS);
+  groups = calloc (group_cnt, sizeof *groups);
+  if (groups == NULL)
+    PANIC ("allocation group creation failed");
+  init_groups ();
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Allocates CNT consecutive sectors, rounded up to whole blocks,
+   from the free map and stores the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
    written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Like free_map_allocate(), but prefers sectors at or after
+   GOAL, first in GOAL's allocation group and then in the groups
+   that follow it. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  return allocate (cnt, goal, sectorp, NULL);
+}
+
+/* Like free_map_allocate_near(), but may use up to *RESERVED
+   sectors reserved by free_map_reserve(), and deducts the ones it
+   uses from *RESERVED. */
+bool
+free_map_allocate_reserved (size_t cnt, block_sector_t goal,
+                            block_sector_t *sectorp, size_t *reserved)
+{
+  return allocate (cnt, goal, sectorp, reserved);
+}
+
+/* Reserves CNT sectors, rounded up to whole blocks, for a later
+   allocation by free_map_allocate_reserved().  Returns true if
+   successful, false if there are not enough free blocks left. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  cnt = DIV_ROUND_UP (cnt, fs_block_sectors);
+  lock_acquire (&free_map_lock);
+  success = total_free - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors reserved by free_map_reserve() and not
+   used since. */
+void
+free_map_unreserve (size_t cnt)
+{
+  cnt = DIV_ROUND_UP (cnt, fs_block_sectors);
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Allocates CNT sectors near GOAL for free_map_allocate_near() or,
+   if RESERVED is nonnull, free_map_allocate_reserved(). */
+static bool
+allocate (size_t cnt, block_sector_t goal, block_sector_t *sectorp,
+          size_t *reserved)
+{
+  size_t block = BITMAP_ERROR;
+  size_t goal_block = goal / fs_block_sectors;
+  size_t usable = 0;
+
+  cnt = DIV_ROUND_UP (cnt, fs_block_sectors);
+
+  lock_acquire (&free_map_lock);
+  if (goal_block >= bitmap_size (free_map))
+    goal_block = 0;
+  if (reserved != NULL)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      usable = *reserved / fs_block_sectors;
+      if (usable > cnt)
+        usable = cnt;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  if (total_free - reserved_cnt + usable < cnt)
+    {
+      lock_release (&free_map_lock);
+      return false;
+    }
+
+  if (fs_log)
+    block = allocate_log (cnt);
+  else
+    {
+      if (cnt <= GROUP_BLOCKS)
+        {
+          size_t first = goal_block / GROUP_BLOCKS;
+          size_t i;
+
+          for (i = 0; i < group_cnt && block == BITMAP_ERROR; i++)
+            block = allocate_in_group ((first + i) % group_cnt, cnt,
+                                       goal_block);
+        }
+
+      /* A free run may cross a group boundary, as runs longer
+         than a group always do, so fall back to scanning the
+         whole map. */
+      if (block == BITMAP_ERROR)
+        block = bitmap_scan (free_map, goal_block, cnt, false);
+      if (block == BITMAP_ERROR)
+        block = bitmap_scan (free_map, 0, cnt, false);
+    }
+
+  if (block != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (free_map, block, cnt, true);
+      update_groups (block, cnt, true);
+      mark_dirty (block, cnt);
+      if (!free_map_flush ())
+        {
+          bitmap_set_multiple (free_map, block, cnt, false);
+          update_groups (block, cnt, false);
+          block = BITMAP_ERROR;
+        }
+    }
+  if (block != BITMAP_ERROR && usable > 0)
+    {
+      reserved_cnt -= usable;
+      *reserved -= usable * fs_block_sectors;
+    }
+  lock_release (&free_map_lock);
+  if (block != BITMAP_ERROR)
+    {
+      *sectorp = block * fs_block_sectors;
+      journal_order_data ();
+    }
+  return block != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Returns the number of blocks in a log segment. */
+static size_t
+segment_blocks (void)
+{
+  return LOG_SEGMENT_SECTORS / fs_block_sectors;
+}
+
+/* Returns true if the CNT blocks starting at BLOCK lie on the
+   disk and are all free. */
+static bool
+run_free (size_t block, size_t cnt)
+{
+  return (block + cnt <= bitmap_size (free_map)
+          && !bitmap_contains (free_map, block, cnt, true));
+}
+
+/* Finds CNT free blocks in a row at the log head, in the next
+   clean segment, or failing those anywhere, and advances the
+   head past them.  Returns the first block of the run, or
+   BITMAP_ERROR if there is none.  Does not modify the free map.
+   Caller must hold FREE_MAP_LOCK. */
+static size_t
+allocate_log (size_t cnt)
+{
+  size_t seg = segment_blocks ();
+  size_t seg_cnt = DIV_ROUND_UP (bitmap_size (free_map), seg);
+  size_t block = BITMAP_ERROR;
+
+  if (log_head >= bitmap_size (free_map))
+    log_head = 0;
+  if (run_free (log_head, cnt)
+      && (cnt > seg || log_head / seg == (log_head + cnt - 1) / seg))
+    block = log_head;
+  else if (cnt <= seg)
+    {
+      size_t first = log_head / seg + 1;
+      size_t i;
+
+      for (i = 0; i < seg_cnt && block == BITMAP_ERROR; i++)
+        {
+          size_t start = (first + i) % seg_cnt * seg;
+          size_t size = bitmap_size (free_map) - start < seg
+                        ? bitmap_size (free_map) - start : seg;
+          if (size >= cnt && run_free (start, size))
+            block = start;
+        }
+    }
+  if (block == BITMAP_ERROR)
+    block = bitmap_scan (free_map, log_head, cnt, false);
+  if (block == BITMAP_ERROR)
+    block = bitmap_scan (free_map, 0, cnt, false);
+  if (block != BITMAP_ERROR)
+    log_head = block + cnt;
+  return block;
+}
+
+/* Returns the sector at the log head, to be saved in a
+   checkpoint. */
+block_sector_t
+free_map_log_head (void)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = log_head * fs_block_sectors;
+  lock_release (&free_map_lock);
+  return sector;
+}
+
+/* Moves the log head to SECTOR, as read from a checkpoint. */
+void
+free_map_seek_log (block_sector_t sector)
+{
+  lock_acquire (&free_map_lock);
+  log_head = sector / fs_block_sectors;
+  lock_release (&free_map_lock);
+}
+
+/* Returns the number of clean segments, those with no block in
+   use. */
+size_t
+free_map_clean_segments (void)
+{
+  size_t seg = segment_blocks ();
+  size_t cnt = 0;
+  size_t start;
+
+  lock_acquire (&free_map_lock);
+  for (start = 0; start + seg <= bitmap_size (free_map); start += seg)
+    if (run_free (start, seg))
+      cnt++;
+  lock_release (&free_map_lock);
+  return cnt;
+}
+
+/* Chooses a segment for the cleaner to empty: the one with the
+   fewest blocks in use, among those that are neither clean nor
+   more than three quarters full, and that do not hold the log
+   head.  Stores its first sector into *START and its length in
+   sectors into *CNT.  Returns false if there is no such
+   segment. */
+bool
+free_map_pick_victim (block_sector_t *start, size_t *cnt)
+{
+  size_t seg = segment_blocks ();
+  size_t best = BITMAP_ERROR, best_used = seg * 3 / 4 + 1;
+  size_t block;
+
+  lock_acquire (&free_map_lock);
+  for (block = 0; block + seg <= bitmap_size (free_map); block += seg)
+    {
+      size_t used = bitmap_count (free_map, block, seg, true);
+      if (used > 0 && used < best_used && log_head / seg != block / seg)
+        {
+          best = block;
+          best_used = used;
+        }
+    }
+  lock_release (&free_map_lock);
+
+  if (best == BITMAP_ERROR)
+    return false;
+  *start = best * fs_block_sectors;
+  *cnt = seg * fs_block_sectors;
+  return true;
+}
+
+/* Adds a reference to each block that contains one of the CNT
+   sectors starting at SECTOR, all of which must be in use, so
+   that one more release is needed to free it.  Returns true if
+   successful, false if a block already has the most references
+   a count can hold or if the reference count file could not be
+   written, in which case no count changes. */
+bool
+free_map_share (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / fs_block_sectors;
+  size_t last = (sector + cnt - 1) / fs_block_sectors;
+  size_t block;
+  bool success = true;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, first, last - first + 1));
+  for (block = first; block <= last; block++)
+    if (refs[block] == UINT8_MAX)
+      success = false;
+  if (success)
+    {
+      for (block = first; block <= last; block++)
+        {
+          if (refs[block]++ == 0)
+            shared_cnt++;
+          mark_refs_dirty (block);
+        }
+      if (!free_map_flush ())
+        {
+          for (block = first; block <= last; block++)
+            if (--refs[block] == 0)
+              shared_cnt--;
+          success = false;
+        }
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Returns true if the block that contains SECTOR is in use by
+   more than one file, so that it must be copied before it is
+   written. */
+bool
+free_map_shared (block_sector_t sector)
+{
+  bool shared;
+
+  lock_acquire (&free_map_lock);
+  shared = refs[sector / fs_block_sectors] > 0;
+  lock_release (&free_map_lock);
+  return shared;
+}
+
+/* Makes the blocks that contain the CNT sectors starting at
+   SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  lock_acquire (&free_map_lock);
+  clear (sector, cnt);
+  free_map_flush ();
+  lock_release (&free_map_lock);
+}
+
+/* Makes the blocks that contain each of the CNT runs of sectors
+   in RUNS available for use, writing the free map once for all
+   of them. */
+void
+free_map_release_runs (const struct free_run runs[], size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < cnt; i++)
+    clear (runs[i].start, runs[i].cnt);
+  free_map_flush ();
+  lock_release (&free_map_lock);
+}
+
+/* Drops a reference to each block that contains one of the CNT
+   sectors starting at SECTOR, marking the ones that have no other
+   references as free, without writing the free map.  Caller must
+   hold FREE_MAP_LOCK. */
+static void
+clear (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / fs_block_sectors;
+  size_t block_cnt = (sector + cnt - 1) / fs_block_sectors - first + 1;
+  size_t block;
+
+  ASSERT (bitmap_all (free_map, first, block_cnt));
+  if (shared_cnt == 0)
+    {
+      bitmap_set_multiple (free_map, first, block_cnt, false);
+      update_groups (first, block_cnt, false);
+      mark_dirty (first, block_cnt);
+      return;
+    }
+
+  for (block = first; block < first + block_cnt; block++)
+    if (refs[block] > 0)
+      {
+        if (--refs[block] == 0)
+          shared_cnt--;
+        mark_refs_dirty (block);
+      }
+    else
+      {
+        bitmap_reset (free_map, block);
+        update_groups (block, 1, false);
+        mark_dirty (block, 1);
+      }
+}
+
+/* Returns the number of blocks in allocation group GROUP. */
+static size_t
+group_size (size_t group)
+{
+  size_t start = group * GROUP_BLOCKS;
+  size_t end = start + GROUP_BLOCKS;
+
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  return end - start;
+}
+
+/* Recomputes every group's free block count from the free
+   map. */
+static void
+init_groups (void)
+{
+  size_t i;
+
+  total_free = 0;
+  for (i = 0; i < group_cnt; i++)
+    {
+      groups[i].free_cnt = bitmap_count (free_map, i * GROUP_BLOCKS,
+                                         group_size (i), false);
+      groups[i].longest_valid = false;
+      total_free += groups[i].free_cnt;
+    }
+}
+
+/* Updates the groups that contain the CNT blocks starting at
+   BLOCK, which have just been allocated if ALLOCATED is true or
+   released otherwise. */
+static void
+update_groups (size_t block, size_t cnt, bool allocated)
+{
+  while (cnt > 0)
+    {
+      struct alloc_group *g = &groups[block / GROUP_BLOCKS];
+      size_t n = GROUP_BLOCKS - block % GROUP_BLOCKS;
+
+      if (n > cnt)
+        n = cnt;
+      if (allocated)
+        {
+          g->free_cnt -= n;
+          total_free -= n;
+        }
+      else
+        {
+          g->free_cnt += n;
+          total_free += n;
+        }
+      g->longest_valid = false;
+
+      block += n;
+      cnt -= n;
+    }
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Returns the first block of a run of CNT free blocks that lies
+   within blocks START through END - 1, or BITMAP_ERROR if there
+   is none.  Updates *LONGEST to the longest free run seen, if
+   longer. */
+static size_t
+scan_range (size_t start, size_t end, size_t cnt, size_t *longest)
+{
+  size_t run = 0;
+  size_t i;
+
+  for (i = start; i < end; i++)
+    if (bitmap_test (free_map, i))
+      run = 0;
+    else
+      {
+        if (++run > *longest)
+          *longest = run;
+        if (run == cnt)
+          return i + 1 - cnt;
+      }
+  return BITMAP_ERROR;
+}
+
+/* Finds CNT free blocks in a row within allocation group GROUP,
+   preferring those at or after block GOAL if GOAL lies in the
+   group.  Returns the first block of the run, or BITMAP_ERROR if
+   the group has no such run.  Does not modify the free map. */
+static size_t
+allocate_in_group (size_t group, size_t cnt, size_t goal)
+{
+  struct alloc_group *g = &groups[group];
+  size_t start = group * GROUP_BLOCKS;
+  size_t end = start + group_size (group);
+  size_t longest = 0;
+  size_t block = BITMAP_ERROR;
+
+  if (g->free_cnt < cnt || (g->longest_valid && g->longest < cnt))
+    return BITMAP_ERROR;
+
+  if (goal > start && goal < end)
+    block = scan_range (goal, end, cnt, &longest);
+  if (block == BITMAP_ERROR)
+    {
+      longest = 0;
+      block = scan_range (start, end, cnt, &longest);
+      if (block == BITMAP_ERROR)
+        {
+          /* The whole group was scanned, so LONGEST is exact. */
+          g->longest = longest;
+          g->longest_valid = true;
+        }
+    }
+  return block;
+}
+
+/* Records that the free map bits for CNT blocks starting at BLOCK
+   have changed. */
+static void
+mark_dirty (size_t block, size_t cnt)
+{
+  size_t first, last;
+
+  if (cnt == 0)
+    return;
+  first = block / BITS_PER_SECTOR;
+  last = (block + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Records that BLOCK's reference count has changed. */
+static void
+mark_refs_dirty (size_t block)
+{
+  bitmap_mark (refs_dirty, block / BLOCK_SECTOR_SIZE);
+}
+
+/* Writes the dirty sectors of the free map to the free map file,
+   and those of the reference counts to the reference count file.
+   Does nothing for a file that has not been opened yet, since
+   free_map_create() writes each one whole.
+   Returns true if successful, false otherwise. */
+bool
+free_map_flush (void)
+{
+  size_t idx;
+
+  if (free_map_file == NULL)
+    return true;
+
+  for (idx = bitmap_scan (dirty_map, 0, 1, true); idx != BITMAP_ERROR;
+       idx = bitmap_scan (dirty_map, idx + 1, 1, true))
+    {
+      if (!bitmap_write_part (free_map, free_map_file,
+                              idx * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        return false;
+      bitmap_reset (dirty_map, idx);
+    }
+
+  if (refs_file == NULL)
+    return true;
+
+  for (idx = bitmap_scan (refs_dirty, 0, 1, true); idx != BITMAP_ERROR;
+       idx = bitmap_scan (refs_dirty, idx + 1, 1, true))
+    {
+      off_t ofs = idx * BLOCK_SECTOR_SIZE;
+      off_t size = bitmap_size (free_map) - ofs;
+      if (size > BLOCK_SECTOR_SIZE)
+        size = BLOCK_SECTOR_SIZE;
+      if (file_write_at (refs_file, refs + ofs, size, ofs) != size)
+        return false;
+      bitmap_reset (refs_dirty, idx);
+    }
+  return true;
+}
+
+/* Opens the free map and reference count files and reads them
+   from disk. */
 void
 free_map_open (void) 
 {
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  size_t idx;
+
+  free_map_file = file_open (inode_mark_metadata
+                               (inode_open (FREE_MAP_SECTOR)));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
+  init_groups ();
+
+  refs_file = file_open (inode_mark_metadata
+                           (inode_open (REFCOUNT_SECTOR)));
+  if (refs_file == NULL)
+    PANIC ("can't open reference counts");
+  if (file_read_at (refs_file, refs, bitmap_size (free_map), 0)
+      != (off_t) bitmap_size (free_map))
+    PANIC ("can't read reference counts");
+  bitmap_set_all (refs_dirty, false);
+  for (shared_cnt = 0, idx = 0; idx < bitmap_size (free_map); idx++)
+    if (refs[idx] > 0)
+      shared_cnt++;
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Writes the free map and reference counts to disk and closes
+   their files. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  file_close (refs_file);
+  refs_file = NULL;
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
-/* Creates a new free map file on disk and writes the free map to
-   it. */
+/* Creates new free map and reference count files on disk and
+   writes the free map and counts to them. */
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The file starts out as a hole, so this
+     allocates its sectors, which changes the bitmap as it is being
+     written.  Leave FREE_MAP_FILE null meanwhile, so that the
+     allocations do not try to write the file recursively, and
+     then write whatever they changed. */
+  file = file_open (inode_mark_metadata (inode_open (FREE_MAP_SECTOR)));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  free_map_file = file;
+  if (!free_map_flush ())
+    PANIC ("can't write free map");
+
+  /* Likewise write the reference counts, all zero, so that the
+     file has every sector it will need. */
+  if (!inode_create (REFCOUNT_SECTOR, bitmap_size (free_map)))
+    PANIC ("reference count creation failed");
+  file = file_open (inode_mark_metadata (inode_open (REFCOUNT_SECTOR)));
+  if (file == NULL)
+    PANIC ("can't open reference counts");
+  if (file_write_at (file, refs, bitmap_size (free_map), 0)
+      != (off_t) bitmap_size (free_map))
+    PANIC ("can't write reference counts");
+  refs_file = file;
 }
@@ -10,8 +10,31 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+bool free_map_flush (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (size_t, block_sector_t goal, block_sector_t *);
+bool free_map_allocate_reserved (size_t, block_sector_t goal,
+                                 block_sector_t *, size_t *reserved);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
 void free_map_release (block_sector_t, size_t);
+bool free_map_share (block_sector_t, size_t);
+bool free_map_shared (block_sector_t);
+
+/* A run of sectors to release. */
+struct free_run
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+void free_map_release_runs (const struct free_run[], size_t cnt);
+
+/* Log-structured allocation. */
+block_sector_t free_map_log_head (void);
+void free_map_seek_log (block_sector_t);
+size_t free_map_clean_segments (void);
+bool free_map_pick_victim (block_sector_t *start, size_t *cnt);
 
 #endif /* filesys/free-map.h */
@@ -7,6 +7,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/vfs.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -15,15 +16,16 @@
 void
 fsutil_ls (char **argv UNUSED) 
 {
-  struct dir *dir;
-  char name[NAME_MAX + 1];
+  struct file *dir;
+  struct vfs_dirent entry;
   
   printf ("Files in the root directory:\n");
-  dir = dir_open_root ();
-  if (dir == NULL)
+  dir = filesys_open (".");
+  if (dir == NULL || !file_is_dir (dir))
     PANIC ("root dir open failed");
-  while (dir_readdir (dir, name))
-    printf ("%s\n", name);
+  while (file_readdir (dir, &entry, 1) > 0)
+    printf ("%s\n", entry.name);
+  file_close (dir);
   printf ("End of listing.\n");
 }
 
@@ -66,6 +68,21 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Moves fragmented files into contiguous free space and reports
+   fragmentation before and after. */
+void
+fsutil_defrag (char **argv UNUSED)
+{
+  struct frag_stats before, after;
+
+  printf ("Defragmenting file system...\n");
+  filesys_defrag (&before, &after);
+  printf ("before: %u files, %u fragmented, %u runs\n",
+          before.files, before.fragmented, before.runs);
+  printf ("after: %u files, %u fragmented, %u runs (%u moved)\n",
+          after.files, after.fragmented, after.runs, after.moved);
+}
+
 /* Extracts a ustar-format tar archive from the scratch block
    device into the Pintos file system. */
 void
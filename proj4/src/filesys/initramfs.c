@@ -0,0 +1,103 @@
+#include "filesys/initramfs.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <ustar.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/tmpfs.h"
+#include "threads/vaddr.h"
+
+/* The initial RAM file system is a ustar archive linked into the
+   kernel image by initramfs-data.S.  If there is one, the kernel
+   boots with a tmpfs as its root, filled with the archive's
+   files, instead of with the disk, so that it can run user
+   programs without a formatted file system disk or a scratch
+   disk to extract them from.
+
+   The archive is part of the kernel image, so it counts against
+   the image's size limit. */
+extern const char _initramfs_start[];
+extern const uint32_t _initramfs_size;
+
+/* Returns true if the kernel has an initial RAM file system. */
+bool
+initramfs_present (void)
+{
+  return _initramfs_size > 0;
+}
+
+/* Adds the pages that file FILE_NAME of SIZE bytes will take in
+   the tmpfs to *AUX, a size_t. */
+static bool
+count_pages (const char *file_name UNUSED, enum ustar_type type,
+             const void *data UNUSED, int size, void *aux)
+{
+  size_t *pages = aux;
+
+  if (type == USTAR_REGULAR)
+    *pages += DIV_ROUND_UP (size, PGSIZE);
+  return true;
+}
+
+/* Creates a file in the root with the SIZE bytes of DATA, named
+   for the last component of FILE_NAME.  The root is the only
+   directory, so directories in the archive are skipped and the
+   files in them are put in the root, which panics if two of them
+   have the same name. */
+static bool
+unpack_file (const char *file_name, enum ustar_type type,
+             const void *data, int size, void *aux UNUSED)
+{
+  const char *name = file_name;
+  const char *slash;
+  struct file *file;
+
+  if (type == USTAR_DIRECTORY)
+    {
+      printf ("initramfs: skipping directory %s\n", file_name);
+      return true;
+    }
+
+  while ((slash = strchr (name, '/')) != NULL)
+    name = slash + 1;
+  if (name != file_name)
+    printf ("initramfs: unpacking %s as %s\n", file_name, name);
+
+  if (!filesys_create (name, 0))
+    PANIC ("initramfs: %s: create failed", file_name);
+  file = filesys_open (name);
+  if (file == NULL)
+    PANIC ("initramfs: %s: open failed", file_name);
+  if (file_write (file, data, size) != size)
+    PANIC ("initramfs: %s: write failed", file_name);
+  file_close (file);
+  return true;
+}
+
+/* Mounts a tmpfs at the root and unpacks the initial RAM file
+   system into it.  The tmpfs may use as many pages as the
+   archive's files fill, plus the usual allowance for files
+   created later. */
+void
+initramfs_mount (void)
+{
+  size_t pages = 0;
+  const char *error;
+
+  ASSERT (initramfs_present ());
+
+  error = ustar_unpack (_initramfs_start, _initramfs_size,
+                        count_pages, &pages);
+  if (error != NULL)
+    PANIC ("initramfs: %s", error);
+  if (!tmpfs_mount ("/", pages + TMPFS_MAX_PAGES))
+    PANIC ("initramfs: can't mount tmpfs at root");
+  error = ustar_unpack (_initramfs_start, _initramfs_size,
+                        unpack_file, NULL);
+  if (error != NULL)
+    PANIC ("initramfs: %s", error);
+  printf ("initramfs: unpacked %'"PRIu32" bytes\n", _initramfs_size);
+}
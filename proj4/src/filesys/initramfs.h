@@ -0,0 +1,9 @@
+#ifndef FILESYS_INITRAMFS_H
+#define FILESYS_INITRAMFS_H
+
+#include <stdbool.h>
+
+bool initramfs_present (void);
+void initramfs_mount (void);
+
+#endif /* filesys/initramfs.h */
@@ -1,48 +1,91 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/lz.h"
 #include "threads/malloc.h"
-#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-#define NUM_DIRECT_INDEX 122 
-#define NUM_INDEX_PER_SEC ( BLOCK_SECTOR_SIZE / 4 ) 
-#define LEVEL0_CAP ( NUM_DIRECT_INDEX*BLOCK_SECTOR_SIZE)
-#define LEVEL1_CAP ( NUM_INDEX_PER_SEC*BLOCK_SECTOR_SIZE)
-#define LEVEL2_CAP ( NUM_INDEX_PER_SEC*NUM_INDEX_PER_SEC*BLOCK_SECTOR_SIZE)
+/* A run of contiguous sectors in a file.
+   File sector LOGICAL + i is stored in disk sector START + i,
+   for 0 <= i < LENGTH. */
+struct extent
+  {
+    uint32_t logical;                   /* First file sector covered. */
+    block_sector_t start;               /* First disk sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
 
-// static struct lock openInodeLock; 
-// static struct hash openInodes;
+/* Number of extents stored in the inode sector itself. */
+#define INODE_EXTENT_CNT 40
+
+/* A file whose data fits in the space used for extents is stored
+   inline, right in its inode sector, instead of in data sectors.
+   It is moved out to a data sector when it grows past
+   INODE_INLINE_MAX bytes. */
+#define INODE_INLINE_MAX (INODE_EXTENT_CNT * sizeof (struct extent))
+
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is in INLINE_DATA. */
+#define INODE_COMPRESSED 0x2            /* Data is in compressed clusters. */
+
+/* A compressed file's data is divided into clusters of
+   CLUSTER_SECTORS sectors, each compressed on its own.  A cluster
+   whose compressed form, with its 2-byte length header, fits in
+   fewer sectors occupies only the first ones of its file sectors,
+   leaving the rest as a hole; one that does not compress is stored
+   whole, and one that is all zeros is left a hole entirely.  So
+   the extent map alone tells how each cluster is stored, and
+   moving sectors around, as the defragmenter and cleaner do,
+   works the same as for any other file. */
+#define CLUSTER_SECTORS 8
+#define CLUSTER_BYTES (CLUSTER_SECTORS * BLOCK_SECTOR_SIZE)
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
-  
-    // block_sector_t index0 [NUM_DIRECT_INDEX];
-    // block_sector_t index1;
-    // block_sector_t index2;
-    // int isDirectory;
-
+    uint32_t extent_cnt;                /* Number of extents in file. */
+    block_sector_t overflow;            /* First overflow block, or 0. */
+    union
+      {
+        struct extent extents[INODE_EXTENT_CNT]; /* First extents, in order. */
+        uint8_t inline_data[INODE_INLINE_MAX];   /* If INODE_INLINE. */
+      };
+    uint32_t flags;                     /* INODE_* flags. */
+    block_sector_t next_orphan;         /* Next orphaned inode, or 0. */
+    uint32_t reclaimed;                 /* Extents freed, if orphaned. */
+    uint32_t unused[1];                 /* Not used. */
   };
 
-//Proj4
-struct indirectBlock {
-
-  block_sector_t index [NUM_INDEX_PER_SEC];
+/* Number of extents in an overflow block. */
+#define OVERFLOW_EXTENT_CNT 42
 
-};
+/* Extents that do not fit in the inode sector continue in a chain
+   of overflow blocks.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct overflow_block
+  {
+    block_sector_t next;                /* Next overflow block, or 0. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[OVERFLOW_EXTENT_CNT]; /* Next extents, in order. */
+  };
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -52,293 +95,1301 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Delayed allocation.  Data appended past the last allocated
+   sector of a file is kept in a page of memory instead of being
+   given disk sectors right away.  Only when the page fills up, a
+   write lands elsewhere, the file is closed or the writeback
+   thread comes around are sectors allocated for it, all in one
+   run, so that a file written a little at a time still ends up
+   contiguous on disk and the free map is updated once per page
+   instead of once per write. */
+#define DELAY_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* How often the writeback thread allocates delayed data, and at
+   most how many inodes it handles each time. */
+#define WRITEBACK_INTERVAL TIMER_FREQ
+#define WRITEBACK_BATCH 16
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in inode_table. */
+    struct list_elem lru_elem;          /* Element in closed_inodes or,
+                                           once removed, reclaim_list. */
+    struct list_elem orphan_elem;       /* Element in orphans, once
+                                           removed. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* Still being read from disk? */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool metadata;                      /* Data goes through the journal? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
-    //struct hash_elem elem;
-    struct lock inodeLock;
+    struct lock inodeLock;              /* Protects the extent map. */
     struct lock directoryLock;
     bool isDirectory;
     off_t length;
+
+    /* Extent map, the in-memory copy of every extent in the
+       inode sector and its overflow blocks. */
+    struct extent *extents;             /* Extents, sorted by LOGICAL. */
+    size_t extent_cnt;                  /* Number of extents. */
+    size_t extent_cap;                  /* Allocated size of EXTENTS. */
+    block_sector_t *overflow;           /* Overflow block sectors, in order. */
+    size_t overflow_cnt;                /* Number of overflow blocks. */
+
+    /* Delayed data: file sectors PENDING_FIRST through
+       PENDING_FIRST + PENDING_CNT - 1, which have no disk sectors
+       yet (or, after a failed allocation, only some of them).
+       Enough free blocks for them, and for one more overflow
+       block, are reserved in the free map. */
+    uint8_t *pending;                   /* DELAY_SECTORS sectors, or null. */
+    uint32_t pending_first;             /* File sector of PENDING[0]. */
+    size_t pending_cnt;                 /* Number of sectors in PENDING. */
+    size_t reserved;                    /* Sectors reserved for PENDING
+                                           or for CLUSTER. */
+
+    /* For a compressed file, the most recently used cluster,
+       decompressed.  While it is dirty, enough free blocks to
+       store it whole, and one more overflow block, are reserved
+       in the free map. */
+    uint8_t *cluster;                   /* CLUSTER_BYTES bytes, or null. */
+    uint32_t cluster_idx;               /* Its index, if CLUSTER_VALID. */
+    bool cluster_valid;                 /* Does CLUSTER hold data? */
+    bool cluster_dirty;                 /* Written but not yet stored? */
   };
 
-static bool extendInodeSize( struct inode_disk *inodeDisk, const off_t length ) {
+/* Returns true if INODE's data is stored in its inode sector. */
+static inline bool
+is_inline (const struct inode *inode)
+{
+  return (inode->data.flags & INODE_INLINE) != 0;
+}
 
-  off_t extend = length - inodeDisk->length;
-  off_t left = ROUND_UP( inodeDisk->length, BLOCK_SECTOR_SIZE) - inodeDisk->length;
+/* Returns true if INODE's data is stored in compressed
+   clusters. */
+static inline bool
+is_compressed (const struct inode *inode)
+{
+  return (inode->data.flags & INODE_COMPRESSED) != 0;
+}
 
-  if ( extend <= left ) {
+/* Returns true if INODE holds delayed data or a dirty cluster,
+   which are not yet in the buffer cache. */
+static inline bool
+is_dirty (const struct inode *inode)
+{
+  return inode->pending_cnt > 0 || inode->cluster_dirty;
+}
 
-    inodeDisk->length = length;
-    return true;
+/* Returns the index of the last extent in INODE whose LOGICAL is
+   at most FILE_SECTOR, or INODE->extent_cnt if there is none.
+   Caller must hold INODE's lock. */
+static size_t
+find_extent (const struct inode *inode, uint32_t file_sector)
+{
+  size_t lo = 0, hi = inode->extent_cnt;
 
-  } else {
+  if (hi == 0 || inode->extents[0].logical > file_sector)
+    return inode->extent_cnt;
 
-    inodeDisk->length = ROUND_UP( inodeDisk->length, BLOCK_SECTOR_SIZE );
+  /* Binary search for the last extent starting at or before
+     FILE_SECTOR. */
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (inode->extents[mid].logical <= file_sector)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
 
-    // while ( inodeDisk->length < length ) {
+/* Returns the disk sector that holds file sector FILE_SECTOR of
+   INODE, or -1 if FILE_SECTOR lies in a hole.
+   Caller must hold INODE's lock. */
+static block_sector_t
+lookup_sector (const struct inode *inode, uint32_t file_sector)
+{
+  size_t i = find_extent (inode, file_sector);
 
-    //   if ( !)
+  if (i < inode->extent_cnt)
+    {
+      const struct extent *e = &inode->extents[i];
+      if (file_sector - e->logical < e->length)
+        return e->start + (file_sector - e->logical);
+    }
+  return -1;
+}
 
-    // }
+/* Returns the block device sector that contains byte offset POS
+   within INODE.
+   Returns -1 if INODE does not contain data for a byte at offset
+   POS, either because POS is past end of file or because it lies
+   in a hole.
+   Binary-searches the extent map, so no disk access or memory
+   allocation is needed.  Caller must hold INODE's lock. */
+static block_sector_t
+byte_to_sector (const struct inode *inode, off_t pos) 
+{
+  ASSERT (inode != NULL);
+  if (pos >= inode->data.length)
+    return -1;
+  return lookup_sector (inode, pos / BLOCK_SECTOR_SIZE);
+}
 
-    inodeDisk->length = length;
-    return true;
+/* Makes room in INODE's extent map for one more extent.
+   Returns true if successful, false if memory is exhausted. */
+static bool
+reserve_extent (struct inode *inode)
+{
+  if (inode->extent_cnt == inode->extent_cap)
+    {
+      size_t new_cap = inode->extent_cap * 2;
+      struct extent *extents = realloc (inode->extents,
+                                        new_cap * sizeof *extents);
+      if (extents == NULL)
+        return false;
+      inode->extents = extents;
+      inode->extent_cap = new_cap;
+    }
+  return true;
+}
 
-  }
+/* Adds an extent mapping the LENGTH file sectors starting at
+   LOGICAL, which must all be holes, to the LENGTH disk sectors
+   starting at START, merging it with its neighbors where both
+   the file and disk sectors are contiguous.
+   Returns true if successful, false if memory is exhausted. */
+static bool
+insert_extent (struct inode *inode, uint32_t logical, block_sector_t start,
+               size_t length)
+{
+  size_t i = find_extent (inode, logical);
+  struct extent *prev, *next;
 
-}
+  /* I is the index of the new extent's predecessor, if any;
+     the new extent goes at index POS. */
+  size_t pos = i < inode->extent_cnt ? i + 1 : 0;
+  prev = pos > 0 ? &inode->extents[pos - 1] : NULL;
+  next = pos < inode->extent_cnt ? &inode->extents[pos] : NULL;
 
-static inline off_t directOffset( off_t offset ) {
+  if (prev != NULL && prev->logical + prev->length == logical
+      && prev->start + prev->length == start)
+    {
+      prev->length += length;
+      if (next != NULL && prev->logical + prev->length == next->logical
+          && prev->start + prev->length == next->start)
+        {
+          /* The new extent bridges PREV and NEXT. */
+          prev->length += next->length;
+          memmove (next, next + 1,
+                   (inode->extent_cnt - pos - 1) * sizeof *next);
+          inode->extent_cnt--;
+        }
+      return true;
+    }
+  if (next != NULL && logical + length == next->logical
+      && start + length == next->start)
+    {
+      next->logical = logical;
+      next->start = start;
+      next->length += length;
+      return true;
+    }
 
-  ASSERT( offset < LEVEL0_CAP );
-  return offset/BLOCK_SECTOR_SIZE;
+  if (!reserve_extent (inode))
+    return false;
 
+  memmove (inode->extents + pos + 1, inode->extents + pos,
+           (inode->extent_cnt - pos) * sizeof *inode->extents);
+  inode->extents[pos].logical = logical;
+  inode->extents[pos].start = start;
+  inode->extents[pos].length = length;
+  inode->extent_cnt++;
+  return true;
 }
 
-static inline off_t indirectOffset( off_t offset ) {
+/* Writes INODE's extent map and length back to its inode sector
+   and overflow blocks, allocating overflow blocks as needed.
+   Returns true if successful, false if an overflow block could
+   not be allocated. */
+static bool
+write_extents (struct inode *inode)
+{
+  struct overflow_block *block = NULL;
+  size_t done, i;
+  bool success = true;
 
-  ASSERT( offset >= LEVEL0_CAP );
-  ASSERT( offset < LEVEL0_CAP + LEVEL1_CAP );
-  return ( offset - LEVEL0_CAP )/BLOCK_SECTOR_SIZE;
+  inode->data.extent_cnt = inode->extent_cnt;
+  done = inode->extent_cnt < INODE_EXTENT_CNT ? inode->extent_cnt
+                                              : INODE_EXTENT_CNT;
+  memcpy (inode->data.extents, inode->extents,
+          done * sizeof *inode->extents);
 
-}
+  for (i = 0; done < inode->extent_cnt; i++)
+    {
+      size_t cnt = inode->extent_cnt - done;
+      if (cnt > OVERFLOW_EXTENT_CNT)
+        cnt = OVERFLOW_EXTENT_CNT;
+
+      if (block == NULL)
+        {
+          block = calloc (1, sizeof *block);
+          if (block == NULL)
+            {
+              success = false;
+              break;
+            }
+        }
 
-static inline off_t doubleIndirOffset_1( off_t offset ) {
+      /* Allocate another overflow block if needed. */
+      if (i == inode->overflow_cnt)
+        {
+          block_sector_t *overflow;
+          block_sector_t sector;
 
-  ASSERT( offset >= LEVEL0_CAP + LEVEL1_CAP );
-  ASSERT( offset < LEVEL0_CAP + LEVEL1_CAP + LEVEL2_CAP );
-  return ( offset - LEVEL0_CAP - LEVEL1_CAP )/LEVEL1_CAP;
+          overflow = realloc (inode->overflow, (i + 1) * sizeof *overflow);
+          if (overflow == NULL)
+            {
+              success = false;
+              break;
+            }
+          inode->overflow = overflow;
+          if (!free_map_allocate_reserved (1, inode->sector, &sector,
+                                           &inode->reserved))
+            {
+              success = false;
+              break;
+            }
+          inode->overflow[inode->overflow_cnt++] = sector;
+        }
 
+      block->next = (i + 1 < inode->overflow_cnt ? inode->overflow[i + 1]
+                     : 0);
+      memset (block->extents, 0, sizeof block->extents);
+      memcpy (block->extents, inode->extents + done,
+              cnt * sizeof *inode->extents);
+      journal_write (inode->overflow[i], block);
+      done += cnt;
+    }
+  free (block);
+
+  /* Extents that did not make it to disk are dropped from the
+     on-disk count, so that the on-disk inode stays consistent. */
+  if (!success)
+    inode->data.extent_cnt = done;
+  inode->data.overflow = inode->overflow_cnt > 0 ? inode->overflow[0] : 0;
+  journal_write (inode->sector, &inode->data);
+  return success;
 }
 
-static inline off_t doubleIndirOffset_2( off_t offset ) {
+/* Reads INODE's extent map from its inode sector and overflow
+   blocks.  Returns true if successful, false if memory is
+   exhausted. */
+static bool
+read_extents (struct inode *inode)
+{
+  struct overflow_block *block;
+  block_sector_t next;
+  size_t cnt = inode->data.extent_cnt;
+
+  inode->extent_cap = cnt > INODE_EXTENT_CNT ? cnt : INODE_EXTENT_CNT;
+  inode->extents = malloc (inode->extent_cap * sizeof *inode->extents);
+  inode->extent_cnt = 0;
+  inode->overflow = NULL;
+  inode->overflow_cnt = 0;
+  if (inode->extents == NULL)
+    return false;
+
+  inode->extent_cnt = cnt < INODE_EXTENT_CNT ? cnt : INODE_EXTENT_CNT;
+  memcpy (inode->extents, inode->data.extents,
+          inode->extent_cnt * sizeof *inode->extents);
+  if (inode->extent_cnt == cnt)
+    return true;
 
-  ASSERT( offset >= LEVEL0_CAP + LEVEL1_CAP );
-  ASSERT( offset < LEVEL0_CAP + LEVEL1_CAP + LEVEL2_CAP );
-  return ( offset - LEVEL0_CAP ) % LEVEL1_CAP / BLOCK_SECTOR_SIZE;  
+  block = malloc (sizeof *block);
+  if (block == NULL)
+    return false;
+  for (next = inode->data.overflow; next != 0 && inode->extent_cnt < cnt;
+       next = block->next)
+    {
+      size_t n = cnt - inode->extent_cnt;
+      block_sector_t *overflow;
 
+      overflow = realloc (inode->overflow,
+                          (inode->overflow_cnt + 1) * sizeof *overflow);
+      if (overflow == NULL)
+        break;
+      inode->overflow = overflow;
+      inode->overflow[inode->overflow_cnt++] = next;
+
+      cache_read (next, block);
+      if (n > OVERFLOW_EXTENT_CNT)
+        n = OVERFLOW_EXTENT_CNT;
+      memcpy (inode->extents + inode->extent_cnt, block->extents,
+              n * sizeof *inode->extents);
+      inode->extent_cnt += n;
+    }
+  free (block);
+  return inode->extent_cnt == cnt;
 }
 
-static block_sector_t getIndirectSector( block_sector_t sec, off_t offset ) {
+/* Reserves free blocks again for INODE's delayed data, after an
+   allocation that used up some of its reservation had to be
+   released, so that INODE has RESERVED sectors reserved once
+   more, if the free map allows. */
+static void
+restore_reserved (struct inode *inode, size_t reserved)
+{
+  if (inode->reserved < reserved
+      && free_map_reserve (reserved - inode->reserved))
+    inode->reserved = reserved;
+}
 
-  struct indirectBlock *indirectBlock;
-  indirectBlock = malloc( sizeof *indirectBlock );
+/* Gives back whatever INODE still has reserved for its delayed
+   data. */
+static void
+drop_reserved (struct inode *inode)
+{
+  free_map_unreserve (inode->reserved);
+  inode->reserved = 0;
+}
 
-  if ( indirectBlock == NULL ) {
+/* Returns the first file sector of INODE past FILE_SECTOR that
+   is mapped, or UINT32_MAX if there is none.  Caller must hold
+   INODE's lock. */
+static uint32_t
+next_mapped (const struct inode *inode, uint32_t file_sector)
+{
+  size_t i = find_extent (inode, file_sector);
+  size_t next = i < inode->extent_cnt ? i + 1 : 0;
 
-    return -1;
+  return next < inode->extent_cnt ? inode->extents[next].logical : UINT32_MAX;
+}
 
-  }
+/* Allocates disk sectors for the hole in INODE that contains byte
+   offset OFFSET, covering as many of the SIZE bytes starting at
+   OFFSET as lie in the same hole and as the free map can provide
+   in one run.  Holes and runs are whole file system blocks, so
+   that each block of the file is also a block on disk.  If
+   OVERWRITE is true, the caller is about to write those bytes,
+   so only new sectors that they do not cover completely are
+   zeroed; otherwise all of them are.
+   Caller must hold INODE's lock.
+   Returns the disk sector for OFFSET, or -1 if the disk or memory
+   is exhausted, in which case INODE is unchanged. */
+static block_sector_t
+fill_hole (struct inode *inode, off_t offset, off_t size, bool overwrite)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  uint32_t want = offset / BLOCK_SECTOR_SIZE;
+  uint32_t first = ROUND_DOWN (want, fs_block_sectors);
+  uint32_t last = ROUND_UP ((offset + size - 1) / BLOCK_SECTOR_SIZE + 1,
+                            fs_block_sectors) - 1;
+  size_t i = find_extent (inode, first);
+  size_t next = i < inode->extent_cnt ? i + 1 : 0;
+  struct extent *saved;
+  block_sector_t goal, start;
+  size_t reserved = inode->reserved;
+  size_t run, saved_cnt, j;
+
+  ASSERT (size > 0);
+  ASSERT (lookup_sector (inode, first) == (block_sector_t) -1);
+
+  /* Stop at the end of the hole. */
+  if (next < inode->extent_cnt && inode->extents[next].logical <= last)
+    last = inode->extents[next].logical - 1;
+  run = last - first + 1;
+
+  /* Place the new sectors where they would be if the file had no
+     hole here, or near the inode for a file with no data yet. */
+  if (i < inode->extent_cnt)
+    {
+      const struct extent *prev = &inode->extents[i];
+      goal = prev->start + (first - prev->logical);
+    }
+  else
+    goal = inode->sector;
+
+  /* Ask for the whole run, then settle for less.  Delayed data
+     has blocks reserved for it. */
+  while (run > 0 && !free_map_allocate_reserved (run, goal, &start,
+                                                 &inode->reserved))
+    run = ROUND_DOWN (run / 2, fs_block_sectors);
+  if (run == 0)
+    return -1;
 
-  //block_read (fs_device, sec, &inode->data);
+  /* Keep a copy of the extent map in case the new one cannot be
+     recorded on disk. */
+  saved_cnt = inode->extent_cnt;
+  saved = malloc ((saved_cnt > 0 ? saved_cnt : 1) * sizeof *saved);
+  if (saved != NULL)
+    memcpy (saved, inode->extents, saved_cnt * sizeof *saved);
+  if (saved == NULL || !insert_extent (inode, first, start, run))
+    {
+      free (saved);
+      free_map_release (start, run);
+      restore_reserved (inode, reserved);
+      return -1;
+    }
+  if (!write_extents (inode))
+    {
+      /* Put the old map back and record it again; it took no more
+         overflow blocks than are already allocated. */
+      memcpy (inode->extents, saved, saved_cnt * sizeof *saved);
+      inode->extent_cnt = saved_cnt;
+      write_extents (inode);
+      free (saved);
+      free_map_release (start, run);
+      restore_reserved (inode, reserved);
+      return -1;
+    }
+  free (saved);
 
-  block_sector_t sector = indirectBlock->index[offset];
+  /* Zero the new sectors that the caller will only partly
+     overwrite. */
+  for (j = 0; j < run; j++)
+    {
+      off_t sector_start = (off_t) (first + j) * BLOCK_SECTOR_SIZE;
+      if (!overwrite || sector_start < offset
+          || sector_start + BLOCK_SECTOR_SIZE > offset + size)
+        {
+          if (inode->metadata)
+            journal_write (start + j, zeros);
+          else
+            cache_write (start + j, zeros);
+        }
+    }
+  return start + (want - first);
+}
 
-  free( indirectBlock );
-  return sector;
+/* Unmaps file block BLOCK of INODE, which extent I maps,
+   splitting the extent in two if BLOCK lies in its middle.
+   Caller must hold INODE's lock.
+   Returns true if successful, false if memory is exhausted, in
+   which case INODE is unchanged. */
+static bool
+cut_extent (struct inode *inode, size_t i, uint32_t block)
+{
+  struct extent *e = &inode->extents[i];
+  uint32_t head = block - e->logical;
+  uint32_t tail = e->length - head - fs_block_sectors;
 
+  if (head > 0 && tail > 0)
+    {
+      if (!reserve_extent (inode))
+        return false;
+      e = &inode->extents[i];
+      memmove (e + 2, e + 1, (inode->extent_cnt - i - 1) * sizeof *e);
+      e[1].logical = block + fs_block_sectors;
+      e[1].start = e->start + head + fs_block_sectors;
+      e[1].length = tail;
+      e->length = head;
+      inode->extent_cnt++;
+    }
+  else if (head > 0)
+    e->length = head;
+  else if (tail > 0)
+    {
+      e->logical += fs_block_sectors;
+      e->start += fs_block_sectors;
+      e->length = tail;
+    }
+  else
+    {
+      memmove (e, e + 1, (inode->extent_cnt - i - 1) * sizeof *e);
+      inode->extent_cnt--;
+    }
+  return true;
 }
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* Moves file block BLOCK of INODE, which must be mapped, to a
+   newly allocated block, which in a log-structured file system is
+   at the log head, and then frees the old one once the new map
+   is committed.  Copies the
+   block's contents unless COPY is false, in which case the caller
+   is about to overwrite all of it.  Caller must hold INODE's lock.
+   Returns the block's first disk sector, which is the old one if
+   the disk or memory is exhausted. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+relocate_block (struct inode *inode, uint32_t block, bool copy)
 {
+  size_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+  block_sector_t old = lookup_sector (inode, block);
+  size_t saved_cnt = inode->extent_cnt;
+  struct extent *saved;
+  uint8_t *buffer = NULL;
+  block_sector_t new;
+
+  ASSERT (old != (block_sector_t) -1);
+  ASSERT (block % fs_block_sectors == 0);
+
+  saved = malloc (saved_cnt * sizeof *saved);
+  if (copy)
+    buffer = malloc (block_bytes);
+  if (saved == NULL || (copy && buffer == NULL)
+      || !free_map_allocate (fs_block_sectors, &new))
+    {
+      free (saved);
+      free (buffer);
+      return old;
+    }
+  memcpy (saved, inode->extents, saved_cnt * sizeof *saved);
 
-  // if ( pos < LEVEL0_CAP ) {
-
-  //   off_t offset = directOffset( pos );
-  //   return inode->index0[offset];
+  if (copy)
+    {
+      cache_read_at (old, buffer, block_bytes, 0);
+      if (inode->metadata)
+        journal_write_at (new, buffer, block_bytes, 0);
+      else
+        cache_write_at (new, buffer, block_bytes, 0);
+      free (buffer);
+    }
 
-  // } else if ( pos < (LEVEL0_CAP + LEVEL1_CAP) ) {
+  if (!cut_extent (inode, find_extent (inode, block), block)
+      || !insert_extent (inode, block, new, fs_block_sectors)
+      || !write_extents (inode))
+    {
+      /* Put the old map back and record it again; it took no more
+         overflow blocks than are already allocated. */
+      memcpy (inode->extents, saved, saved_cnt * sizeof *saved);
+      inode->extent_cnt = saved_cnt;
+      write_extents (inode);
+      free (saved);
+      if (inode->metadata)
+        journal_revoke (new, fs_block_sectors);
+      free_map_release (new, fs_block_sectors);
+      return old;
+    }
+  free (saved);
 
-  //   off_t indirOffset = indirectOffset( pos );
-  //   return getIndirectSector( inode->index1, indirOffset );
+  if (inode->metadata)
+    journal_revoke (old, fs_block_sectors);
+  journal_release (old, fs_block_sectors);
+  return new;
+}
 
-  // } else if ( pos < (LEVEL0_CAP + LEVEL1_CAP + LEVEL2_CAP) ) {
+/* Returns the disk sector to write file sector FILE_SECTOR of
+   INODE, which must be mapped, after moving its block to the log
+   head in a log-structured file system or, if other files share
+   the block, giving INODE its own copy.  Copies the block's
+   contents unless COPY is false.  Caller must hold INODE's lock.
+   Returns -1 if the block must not be written in place but the
+   disk or memory is exhausted. */
+static block_sector_t
+unshare_block (struct inode *inode, uint32_t file_sector, bool copy)
+{
+  uint32_t block = ROUND_DOWN (file_sector, fs_block_sectors);
+  block_sector_t old = lookup_sector (inode, block);
+  block_sector_t new = relocate_block (inode, block, copy);
 
-  //   off_t indirOffset = doubleIndirOffset_1( pos );
-  //   off_t doubleIndirOffset = doubleIndirOffset_2( pos );
+  if (new == old && free_map_shared (old))
+    return -1;
+  return new + (file_sector - block);
+}
 
-  //   return getIndirectSector( getIndirectSector(inode->index2, indirOffset), doubleIndirOffset );
+/* Compresses INODE->cluster, which holds cluster C of compressed
+   INODE, and stores it in newly allocated sectors in place of the
+   cluster's old ones, which it frees once that change commits.
+   The new sectors come out of INODE's reservation.  Caller must
+   hold INODE's lock.
+   Returns true if successful, false if the disk or memory is
+   exhausted, in which case the cluster's old contents stay on
+   disk. */
+static bool
+store_cluster (struct inode *inode, uint32_t c)
+{
+  size_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+  uint32_t first = c * CLUSTER_SECTORS;
+  size_t saved_cnt = inode->extent_cnt;
+  struct free_run old[CLUSTER_SECTORS];
+  size_t old_cnt = 0, stored = 0, i;
+  const uint8_t *data = inode->cluster;
+  struct extent *saved;
+  uint8_t *packed;
+  block_sector_t start = 0;
+  size_t reserved = inode->reserved;
+  bool success = true;
+
+  packed = malloc (CLUSTER_BYTES);
+  saved = malloc ((saved_cnt > 0 ? saved_cnt : 1) * sizeof *saved);
+  if (packed == NULL || saved == NULL)
+    {
+      free (packed);
+      free (saved);
+      return false;
+    }
+  memcpy (saved, inode->extents, saved_cnt * sizeof *saved);
 
-  // }
+  /* Compress the cluster, unless it is all zeros, and store it
+     whole if that does not save a block. */
+  for (i = 0; i < CLUSTER_BYTES && inode->cluster[i] == 0; i++)
+    continue;
+  if (i < CLUSTER_BYTES)
+    {
+      uint16_t len = lz_compress (inode->cluster, CLUSTER_BYTES,
+                                  packed + sizeof len,
+                                  CLUSTER_BYTES - sizeof len);
+      stored = ROUND_UP (DIV_ROUND_UP (len + sizeof len, BLOCK_SECTOR_SIZE),
+                         fs_block_sectors);
+      if (len == 0 || stored >= CLUSTER_SECTORS)
+        stored = CLUSTER_SECTORS;
+      else
+        {
+          memcpy (packed, &len, sizeof len);
+          data = packed;
+        }
+      success = free_map_allocate_reserved (stored, inode->sector, &start,
+                                            &inode->reserved);
+      for (i = 0; success && i < stored; i += fs_block_sectors)
+        cache_write_at (start + i, data + i * BLOCK_SECTOR_SIZE,
+                        block_bytes, 0);
+    }
 
-  // return -1;
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  /* Map the cluster to the new sectors. */
+  for (i = 0; success && i < CLUSTER_SECTORS; i += fs_block_sectors)
+    {
+      block_sector_t sector = lookup_sector (inode, first + i);
+      if (sector != (block_sector_t) -1)
+        {
+          success = cut_extent (inode, find_extent (inode, first + i),
+                                first + i);
+          old[old_cnt].start = sector;
+          old[old_cnt++].cnt = fs_block_sectors;
+        }
+    }
+  if (success && stored > 0)
+    success = insert_extent (inode, first, start, stored);
+  if (success)
+    success = write_extents (inode);
+
+  if (success)
+    for (i = 0; i < old_cnt; i++)
+      journal_release (old[i].start, old[i].cnt);
   else
-    return -1;
+    {
+      /* Put the old map back and record it again; it took no more
+         overflow blocks than are already allocated. */
+      memcpy (inode->extents, saved, saved_cnt * sizeof *saved);
+      inode->extent_cnt = saved_cnt;
+      write_extents (inode);
+      if (stored > 0 && start != 0)
+        free_map_release (start, stored);
+      restore_reserved (inode, reserved);
+    }
+  free (saved);
+  free (packed);
+  return success;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
-
-// static block_sector_t hashHelper( const struct hash_elem *hashElement, void *aux UNUSED ) {
+/* Makes INODE->cluster hold cluster C of compressed INODE,
+   decompressed, first storing the cluster it holds if that one
+   is dirty.  The stored sectors are read through the buffer
+   cache.  Caller must hold INODE's lock.
+   Returns true if successful, false if the disk or memory is
+   exhausted or the cluster is corrupt. */
+static bool
+load_cluster (struct inode *inode, uint32_t c)
+{
+  size_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+  uint32_t first = c * CLUSTER_SECTORS;
+  size_t stored, i;
+  uint8_t *packed;
+  bool success = true;
 
-//   struct inode *i  = hash_entry( hashElement, struct inode, elem );
-//   return i->sector;
+  if (inode->cluster_valid && inode->cluster_idx == c)
+    return true;
+  if (inode->cluster_dirty)
+    {
+      if (!store_cluster (inode, inode->cluster_idx))
+        return false;
+      inode->cluster_dirty = false;
+      drop_reserved (inode);
+    }
+  if (inode->cluster == NULL)
+    {
+      inode->cluster = palloc_get_page (0);
+      if (inode->cluster == NULL)
+        return false;
+    }
 
-// }
+  /* A cluster is stored in a prefix of its file sectors. */
+  for (stored = 0; stored < CLUSTER_SECTORS; stored += fs_block_sectors)
+    if (lookup_sector (inode, first + stored) == (block_sector_t) -1)
+      break;
+
+  if (stored == 0)
+    memset (inode->cluster, 0, CLUSTER_BYTES);
+  else if (stored == CLUSTER_SECTORS)
+    for (i = 0; i < stored; i += fs_block_sectors)
+      cache_read_at (lookup_sector (inode, first + i),
+                     inode->cluster + i * BLOCK_SECTOR_SIZE, block_bytes, 0);
+  else
+    {
+      uint16_t len;
+
+      packed = malloc (stored * BLOCK_SECTOR_SIZE);
+      if (packed == NULL)
+        return false;
+      for (i = 0; i < stored; i += fs_block_sectors)
+        cache_read_at (lookup_sector (inode, first + i),
+                       packed + i * BLOCK_SECTOR_SIZE, block_bytes, 0);
+      memcpy (&len, packed, sizeof len);
+      success = (len <= stored * BLOCK_SECTOR_SIZE - sizeof len
+                 && lz_decompress (packed + sizeof len, len, inode->cluster,
+                                   CLUSTER_BYTES) == CLUSTER_BYTES);
+      free (packed);
+    }
+  inode->cluster_idx = c;
+  inode->cluster_valid = success;
+  return success;
+}
 
-// static bool compareHash( const struct hash_elem *elem1, const struct hash_elem *elem2, void *aux UNUSED ) {
+/* Reads SIZE bytes from compressed INODE into BUFFER, starting at
+   position OFFSET, a cluster at a time.  Returns the number of
+   bytes actually read, which may be less than SIZE if end of file
+   is reached or an error occurs. */
+static off_t
+read_compressed (struct inode *inode, uint8_t *buffer, off_t size,
+                 off_t offset)
+{
+  off_t bytes_read = 0;
 
-//   struct inode *inode1 = hash_entry( elem1, struct inode, elem );
-//   struct inode *inode2 = hash_entry( elem2, struct inode, elem );
+  /* Loading a cluster may first store a dirty one. */
+  journal_begin ();
+  lock_acquire (&inode->inodeLock);
+  while (size > 0 && offset < inode->data.length)
+    {
+      off_t inode_left = inode->data.length - offset;
+      int cluster_left = CLUSTER_BYTES - offset % CLUSTER_BYTES;
+      off_t chunk_size = size < inode_left ? size : inode_left;
+      if (chunk_size > cluster_left)
+        chunk_size = cluster_left;
 
-//   return inode1->sector < inode2->sector;
+      if (!load_cluster (inode, offset / CLUSTER_BYTES))
+        break;
+      memcpy (buffer + bytes_read, inode->cluster + offset % CLUSTER_BYTES,
+              chunk_size);
 
-// }
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  lock_release (&inode->inodeLock);
+  journal_end ();
+  return bytes_read;
+}
 
-/* Initializes the inode module. */
-void
-inode_init (void) 
+/* Writes SIZE bytes from BUFFER into compressed INODE, starting
+   at OFFSET, a cluster at a time.  A cluster is compressed and
+   stored only when another one is loaded or INODE's delayed data
+   is flushed, so that a run of small writes compresses it once.
+   A cluster is written only if the blocks to store it can be
+   reserved, so that storing it later cannot run out of space.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk or memory is exhausted. */
+static off_t
+write_compressed (struct inode *inode, const uint8_t *buffer, off_t size,
+                  off_t offset)
 {
-  //hash_init( &openInodes, hashHelper, compareHash, NULL );
-  //lock_init( &openInodeLock );
-  list_init (&open_inodes);
+  off_t bytes_written = 0;
+
+  journal_begin ();
+  lock_acquire (&inode->inodeLock);
+  while (size > 0)
+    {
+      int cluster_left = CLUSTER_BYTES - offset % CLUSTER_BYTES;
+      int chunk_size = size < cluster_left ? size : cluster_left;
+
+      if (!load_cluster (inode, offset / CLUSTER_BYTES))
+        break;
+      if (!inode->cluster_dirty)
+        {
+          if (!free_map_reserve (CLUSTER_SECTORS + fs_block_sectors))
+            break;
+          inode->reserved = CLUSTER_SECTORS + fs_block_sectors;
+        }
+      memcpy (inode->cluster + offset % CLUSTER_BYTES,
+              buffer + bytes_written, chunk_size);
+      inode->cluster_dirty = true;
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      journal_write (inode->sector, &inode->data);
+    }
+  lock_release (&inode->inodeLock);
+  journal_end ();
+  return bytes_written;
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
-   Returns true if successful.
-   Returns false if memory or disk allocation fails. */
-bool
-inode_create (block_sector_t sector, off_t length)
+/* Moves the data of inline INODE out to a data sector, so that it
+   can grow past INODE_INLINE_MAX bytes.  Caller must hold INODE's
+   lock.
+   Returns true if successful, false if the disk or memory is
+   exhausted, in which case INODE is left inline. */
+static bool
+promote_inline (struct inode *inode)
 {
-  struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  off_t length = inode->data.length;
+  block_sector_t sector;
+  uint8_t *contents;
 
-  ASSERT (length >= 0);
+  ASSERT (is_inline (inode));
+  ASSERT (inode->extent_cnt == 0);
 
-   // if ( length < 0 ) {
+  contents = malloc (INODE_INLINE_MAX);
+  if (contents == NULL)
+    return false;
+  memcpy (contents, inode->data.inline_data, INODE_INLINE_MAX);
 
-  //   return false;
+  inode->data.flags &= ~INODE_INLINE;
+  memset (inode->data.extents, 0, sizeof inode->data.extents);
+  if (length == 0)
+    {
+      journal_write (inode->sector, &inode->data);
+      free (contents);
+      return true;
+    }
 
-  // }
+  sector = fill_hole (inode, 0, length, true);
+  if (sector != (block_sector_t) -1)
+    {
+      if (inode->metadata)
+        journal_write_at (sector, contents, length, 0);
+      else
+        cache_write_at (sector, contents, length, 0);
+      free (contents);
+      return true;
+    }
 
-  /* If this assertion fails, the inode structure is not exactly
-     one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  /* Put things back the way they were. */
+  inode->data.flags |= INODE_INLINE;
+  memcpy (inode->data.inline_data, contents, INODE_INLINE_MAX);
+  journal_write (inode->sector, &inode->data);
+  free (contents);
+  return false;
+}
 
-  disk_inode = calloc (1, sizeof *disk_inode);
+/* Returns the file sector just past the last one that INODE has a
+   disk sector for.  Caller must hold INODE's lock. */
+static uint32_t
+mapped_end (const struct inode *inode)
+{
+  const struct extent *last;
 
-  // if ( disk_inode == NULL ) {
+  if (inode->extent_cnt == 0)
+    return 0;
+  last = &inode->extents[inode->extent_cnt - 1];
+  return last->logical + last->length;
+}
 
-  //   return false;
+/* Allocates disk sectors for INODE's delayed data, as one run if
+   the free map allows, and writes the data to them, and stores
+   INODE's cluster if it is dirty.  Caller must hold INODE's lock.
+   Returns true if successful, false if the disk or memory is
+   exhausted, in which case the data stays delayed. */
+static bool
+flush_pending (struct inode *inode)
+{
+  size_t i;
 
-  // }
+  if (inode->cluster_dirty)
+    {
+      if (!store_cluster (inode, inode->cluster_idx))
+        return false;
+      inode->cluster_dirty = false;
+    }
+
+  for (i = 0; i < inode->pending_cnt; i += fs_block_sectors)
+    {
+      uint32_t file_sector = inode->pending_first + i;
+      block_sector_t sector = lookup_sector (inode, file_sector);
+
+      if (sector == (block_sector_t) -1)
+        sector = fill_hole (inode, (off_t) file_sector * BLOCK_SECTOR_SIZE,
+                            (off_t) (inode->pending_cnt - i)
+                            * BLOCK_SECTOR_SIZE, true);
+      if (sector == (block_sector_t) -1)
+        return false;
+      cache_write_at (sector, inode->pending + i * BLOCK_SECTOR_SIZE,
+                      fs_block_sectors * BLOCK_SECTOR_SIZE, 0);
+    }
+  inode->pending_cnt = 0;
+  drop_reserved (inode);
+  return true;
+}
+
+/* Returns true if a write to file sector FILE_SECTOR of INODE,
+   which lies in a hole or in the delayed data, should go to
+   INODE's delayed data, adding the sector's block to the delayed
+   data if necessary.  Writes that do not extend the delayed data
+   first cause it to be allocated.  A block is added only if a
+   free block can be reserved for it, so that the delayed data
+   can always be allocated later.  Caller must hold INODE's
+   lock. */
+static bool
+delay_sector (struct inode *inode, uint32_t file_sector)
+{
+  uint32_t block = ROUND_DOWN (file_sector, fs_block_sectors);
+  size_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
 
-  // disk_inode->length = 0;
-  // extendInodeSize( disk_inode, length );
+  /* Metadata goes through the journal, which needs its sectors. */
+  if (inode->metadata)
+    return false;
 
-  // ASSERT( disk_inode->length >= length );
-  // ASSERT( disk_inode->length-length < BLOCK_SECTOR_SIZE );
+  if (inode->pending_cnt > 0)
+    {
+      if (file_sector - inode->pending_first < inode->pending_cnt)
+        return true;
+      if (block == inode->pending_first + inode->pending_cnt
+          && inode->pending_cnt + fs_block_sectors <= DELAY_SECTORS
+          && free_map_reserve (fs_block_sectors))
+        {
+          inode->reserved += fs_block_sectors;
+          memset (inode->pending + inode->pending_cnt * BLOCK_SECTOR_SIZE,
+                  0, block_bytes);
+          inode->pending_cnt += fs_block_sectors;
+          return true;
+        }
+      if (!flush_pending (inode))
+        return false;
+    }
+
+  /* Only appends are delayed; holes in the middle of the file are
+     filled right away. */
+  if (file_sector < mapped_end (inode))
+    return false;
+  if (inode->pending == NULL)
+    {
+      inode->pending = palloc_get_page (0);
+      if (inode->pending == NULL)
+        return false;
+    }
+  if (!free_map_reserve (2 * fs_block_sectors))
+    return false;
+  inode->reserved = 2 * fs_block_sectors;
+  memset (inode->pending, 0, block_bytes);
+  inode->pending_first = block;
+  inode->pending_cnt = fs_block_sectors;
+  return true;
+}
 
-  // disk_inode->start = sector;
-  // disk_inode->magic = INODE_MAGIC;
-  // disk_inode->isDirectory = isDir ? 1 : 0;
+/* Drops every extent of INODE past file sector KEEP, shortening
+   the one that contains it, records the new map on disk and
+   releases the dropped sectors once that change commits.
+   Overflow blocks that are no longer needed stay with INODE for
+   reuse.  Caller must hold INODE's lock.
+   Returns true if successful, false if memory is exhausted, in
+   which case INODE is unchanged. */
+static bool
+truncate_extents (struct inode *inode, uint32_t keep)
+{
+  struct extent *tail;
+  size_t first, tail_cnt, i;
+
+  /* FIRST is the index of the first extent that reaches past
+     KEEP. */
+  first = keep > 0 ? find_extent (inode, keep - 1) : inode->extent_cnt;
+  if (first == inode->extent_cnt)
+    first = 0;
+  else if (inode->extents[first].logical + inode->extents[first].length
+           <= keep)
+    first++;
+  tail_cnt = inode->extent_cnt - first;
+  if (tail_cnt == 0)
+    return true;
 
-  // free( disk_inode );
+  tail = malloc (tail_cnt * sizeof *tail);
+  if (tail == NULL)
+    return false;
+  memcpy (tail, inode->extents + first, tail_cnt * sizeof *tail);
 
-  // return true;
+  if (tail[0].logical < keep)
+    {
+      /* Keep the front of the first extent. */
+      uint32_t kept = keep - tail[0].logical;
+      inode->extents[first].length = kept;
+      tail[0].logical += kept;
+      tail[0].start += kept;
+      tail[0].length -= kept;
+      first++;
+    }
+  inode->extent_cnt = first;
+  write_extents (inode);
 
-  if (disk_inode != NULL)
+  for (i = 0; i < tail_cnt; i++)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
+      if (inode->metadata)
+        journal_revoke (tail[i].start, tail[i].length);
+      journal_release (tail[i].start, tail[i].length);
     }
-  return success;
+  free (tail);
+  return true;
 }
 
-/* Reads an inode from SECTOR
-   and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
-struct inode *
-inode_open (block_sector_t sector)
+/* Table of in-memory inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.
+
+   When the last opener closes an inode that has not been removed,
+   it stays in the table with an open count of 0 and is put on
+   CLOSED_INODES, most recently closed first.  Reopening it then
+   needs no disk access.  The last close allocates an inode's
+   delayed data, so closed inodes normally hold no changes that
+   are not in the buffer cache and can be dropped at any time;
+   only the INODE_CACHE_SIZE most recently closed are kept.  If
+   the allocation fails, the inode keeps its delayed data, and
+   it stays in the table until the writeback thread has
+   allocated it.
+
+   An inode that is not in the table goes in as a placeholder,
+   marked LOADING, while its opener reads it from disk without
+   holding INODE_TABLE_LOCK, so that a cache miss does not hold up
+   every other open.  Other openers of the same sector wait on
+   INODE_LOADED for the read to finish. */
+#define INODE_CACHE_SIZE 32
+static struct hash inode_table;
+static struct list closed_inodes;
+static size_t closed_cnt;               /* Length of CLOSED_INODES. */
+static struct lock inode_table_lock;    /* Protects the above and
+                                           each inode's OPEN_CNT and
+                                           LOADING. */
+static struct condition inode_loaded;   /* Signaled when a placeholder
+                                           is loaded or dropped. */
+
+/* Removing a file only unlinks its name.  When the last opener
+   closes it, its inode goes on RECLAIM_LIST, and the reclaim
+   thread frees its sectors later, RECLAIM_BATCH runs per journal
+   transaction, so that removing a large file does not make the caller
+   wait for it. */
+#define RECLAIM_BATCH 64
+static struct list reclaim_list;
+static struct lock reclaim_lock;        /* Protects RECLAIM_LIST. */
+static struct condition reclaim_cond;   /* Signaled when it grows. */
+static struct lock reclaimer_lock;      /* Held while freeing. */
+
+/* A removed inode is an orphan until its sectors are free.  The
+   orphans are kept in a list on disk, linked through each inode's
+   NEXT_ORPHAN and starting at the superblock, so that if the
+   system crashes first, the next mount can free them.  ORPHANS
+   mirrors that list, in the same order. */
+static struct list orphans;
+static struct lock orphan_lock;         /* Protects ORPHANS and the
+                                           list on disk. */
+
+/* Returns a hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
 {
-  struct list_elem *e;
-  //struct hash_elem *hashElem;
-  struct inode *inode;
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
 
-  /* Check whether this inode is already open. */
+/* Returns true if the inode containing A precedes the one
+   containing B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
 
-  // struct inode temp;
-  // temp.sector = sector;
+  return a->sector < b->sector;
+}
 
-  // lock_acquire( &openInodeLock );
-  // hashElem = hash_find( &openInodes, &temp.elem );
+/* Initializes the inode module. */
+void
+inode_init (void) 
+{
+  if (!hash_init (&inode_table, inode_hash, inode_less, NULL))
+    PANIC ("inode table allocation failed");
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  lock_init (&inode_table_lock);
+  cond_init (&inode_loaded);
+  list_init (&reclaim_list);
+  lock_init (&reclaim_lock);
+  cond_init (&reclaim_cond);
+  lock_init (&reclaimer_lock);
+  list_init (&orphans);
+  lock_init (&orphan_lock);
+}
 
-  // if ( hashElem != NULL ) {
+/* Returns the in-memory inode for SECTOR, or a null pointer if
+   there is none.  Caller must hold INODE_TABLE_LOCK. */
+static struct inode *
+table_find (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
 
-  //   lock_release( &openInodeLock );
-  //   inode = hash_entry( hashElem, struct inode, elem );
+  key.sector = sector;
+  e = hash_find (&inode_table, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
 
-  //   ASSERT( inode->sector == sector );
+/* Frees INODE's memory. */
+static void
+free_inode (struct inode *inode)
+{
+  free (inode->extents);
+  free (inode->overflow);
+  palloc_free_page (inode->pending);
+  palloc_free_page (inode->cluster);
+  free (inode);
+}
 
-  //   inode_reopen( inode );
+/* Removes closed INODE from the inode table and from
+   CLOSED_INODES.  Caller must hold INODE_TABLE_LOCK and free
+   INODE. */
+static void
+uncache (struct inode *inode)
+{
+  ASSERT (inode->open_cnt == 0);
+  hash_delete (&inode_table, &inode->elem);
+  list_remove (&inode->lru_elem);
+  closed_cnt--;
+}
 
-  //   return inode;
+/* Initializes an inode with LENGTH bytes of data, stored in
+   compressed clusters if COMPRESSED is true, and writes the new
+   inode to sector SECTOR on the file system device.
+   Returns true if successful.
+   Returns false if memory or disk allocation fails. */
+static bool
+create (block_sector_t sector, off_t length, bool compressed)
+{
+  struct inode_disk *disk_inode = NULL;
+  struct inode *inode;
 
-  //}
+  ASSERT (length >= 0);
 
+  /* If these assertions fail, the inode structures are not
+     exactly one sector in size, and you should fix that. */
+  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct overflow_block) == BLOCK_SECTOR_SIZE);
 
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Forget any closed inode that used to live in SECTOR. */
+  lock_acquire (&inode_table_lock);
+  inode = table_find (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      uncache (inode);
+      free_inode (inode);
+    }
+  lock_release (&inode_table_lock);
+
+  /* Write an inode whose data is all zeros: inline if LENGTH bytes
+     fit there and it is not compressed, otherwise one big hole, so
+     no data sectors are allocated until they are written. */
+  disk_inode = calloc (1, sizeof *disk_inode);
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  if (compressed)
+    disk_inode->flags = INODE_COMPRESSED;
+  else if (length <= (off_t) INODE_INLINE_MAX)
+    disk_inode->flags = INODE_INLINE;
+  journal_write (sector, disk_inode);
+  free (disk_inode);
+  return true;
+}
+
+/* Initializes an inode with LENGTH bytes of data and
+   writes the new inode to sector SECTOR on the file system
+   device.
+   Returns true if successful.
+   Returns false if memory or disk allocation fails. */
+bool
+inode_create (block_sector_t sector, off_t length)
+{
+  return create (sector, length, false);
+}
+
+/* Like inode_create(), but the new inode's data is stored in
+   compressed clusters. */
+bool
+inode_create_compressed (block_sector_t sector, off_t length)
+{
+  return create (sector, length, true);
+}
+
+/* Reads an inode from SECTOR
+   and returns a `struct inode' that contains it.
+   Returns a null pointer if memory allocation fails. */
+struct inode *
+inode_open (block_sector_t sector)
+{
+  struct inode *inode;
+
+  /* Check whether this inode is already open, or was recently
+     closed.  If another thread is reading it in, wait for that,
+     and look again in case the read failed. */
+  lock_acquire (&inode_table_lock);
+  while ((inode = table_find (sector)) != NULL && inode->loading)
+    cond_wait (&inode_loaded, &inode_table_lock);
+  if (inode != NULL)
+    {
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->lru_elem);
+          closed_cnt--;
         }
+      lock_release (&inode_table_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->metadata = false;
+  inode->pending = NULL;
+  inode->pending_first = 0;
+  inode->pending_cnt = 0;
+  inode->reserved = 0;
+  inode->cluster = NULL;
+  inode->cluster_valid = false;
+  inode->cluster_dirty = false;
 
-  // lock_init( &inode->inodeLock );
   // lock_init( &inode->directoryLock );
-  // hash_insert( &openInodes, &inode->elem );
-  // lock_release( &openInodeLock );
 
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->inodeLock);
+  hash_insert (&inode_table, &inode->elem);
+  lock_release (&inode_table_lock);
+
+  /* Read it in, with the placeholder in the table. */
+  cache_read (inode->sector, &inode->data);
+  if (!read_extents (inode))
+    {
+      lock_acquire (&inode_table_lock);
+      hash_delete (&inode_table, &inode->elem);
+      cond_broadcast (&inode_loaded, &inode_table_lock);
+      lock_release (&inode_table_lock);
+      free_inode (inode);
+      return NULL;
+    }
+  lock_acquire (&inode_table_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &inode_table_lock);
+  lock_release (&inode_table_lock);
   
   // struct inode_disk *inodeDisk;
   // inodeDisk = malloc( sizeof *inodeDisk );
@@ -363,7 +1414,12 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      ASSERT (inode->open_cnt > 0);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -375,45 +1431,116 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, moves it to the cache
+   of closed inodes, or, if INODE was also a removed inode, frees
+   its memory and its blocks. */
 void
 inode_close (struct inode *inode) 
 {
+  struct inode *victim = NULL;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* The last opener allocates the delayed data, whose blocks were
+     reserved when it was written.  That can still fail if memory
+     is exhausted, and then the data stays with the closed inode
+     for the writeback thread to try again. */
+  lock_acquire (&inode_table_lock);
+  while (inode->open_cnt == 1 && !inode->removed && is_dirty (inode))
+    {
+      bool flushed;
+
+      lock_release (&inode_table_lock);
+      journal_begin ();
+      lock_acquire (&inode->inodeLock);
+      flushed = flush_pending (inode);
+      lock_release (&inode->inodeLock);
+      journal_end ();
+      lock_acquire (&inode_table_lock);
+      if (!flushed)
+        break;
+    }
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
-      // lock_acquire( &openInodeLock );
-      // hash_delete( &openInodes, &inode->elem );
-      // lock_release( &openInodeLock );
+      lock_release (&inode_table_lock);
+      return;
+    }
 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
-        }
-      //lock_release( &inode->inodeLock );
-      free (inode); 
+  if (inode->removed)
+    {
+      /* Nobody can find it any more, so its blocks are ours.
+         Leave freeing them to the reclaim thread. */
+      hash_delete (&inode_table, &inode->elem);
+      lock_release (&inode_table_lock);
+      palloc_free_page (inode->pending);
+      inode->pending = NULL;
+      inode->pending_cnt = 0;
+      drop_reserved (inode);
+      palloc_free_page (inode->cluster);
+      inode->cluster = NULL;
+      lock_acquire (&reclaim_lock);
+      list_push_back (&reclaim_list, &inode->lru_elem);
+      cond_signal (&reclaim_cond, &reclaim_lock);
+      lock_release (&reclaim_lock);
+      return;
     }
 
-    //lock_release( &inode->inodeLock );
+  /* Keep it for a later reopen, dropping the least recently
+     closed inode that holds no delayed data if there are too
+     many. */
+  if (!is_dirty (inode))
+    {
+      palloc_free_page (inode->pending);
+      inode->pending = NULL;
+      palloc_free_page (inode->cluster);
+      inode->cluster = NULL;
+      inode->cluster_valid = false;
+    }
+  list_push_front (&closed_inodes, &inode->lru_elem);
+  if (++closed_cnt > INODE_CACHE_SIZE)
+    {
+      struct list_elem *e;
+
+      for (e = list_rbegin (&closed_inodes); e != list_rend (&closed_inodes);
+           e = list_prev (e))
+        if (!is_dirty (list_entry (e, struct inode, lru_elem)))
+          {
+            victim = list_entry (e, struct inode, lru_elem);
+            uncache (victim);
+            break;
+          }
+    }
+  lock_release (&inode_table_lock);
+  if (victim != NULL)
+    free_inode (victim);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
-   has it open. */
+   has it open, and puts it at the head of the orphan list as part
+   of the running transaction. */
 void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
-  inode->removed = true;
+
+  lock_acquire (&orphan_lock);
+  if (!inode->removed)
+    {
+      struct inode *next = (list_empty (&orphans) ? NULL
+                            : list_entry (list_front (&orphans),
+                                          struct inode, orphan_elem));
+
+      lock_acquire (&inode->inodeLock);
+      inode->data.next_orphan = next != NULL ? next->sector : 0;
+      journal_write (inode->sector, &inode->data);
+      lock_release (&inode->inodeLock);
+      list_push_front (&orphans, &inode->orphan_elem);
+      filesys_set_orphans (inode->sector);
+      inode->removed = true;
+    }
+  lock_release (&orphan_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -431,41 +1558,66 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+
+  if (is_compressed (inode))
+    return read_compressed (inode, buffer, size, offset);
+
+  /* Inline data is already in memory. */
+  lock_acquire (&inode->inodeLock);
+  if (is_inline (inode))
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      lock_release (&inode->inodeLock);
+      return bytes_read;
+    }
+  lock_release (&inode->inodeLock);
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
+      uint32_t pending_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      /* Bytes left in inode, bytes left in file system block,
+         lesser of the two.  The sectors of a block are
+         consecutive on disk, so a chunk may span several. */
       off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int block_left = block_bytes - offset % block_bytes;
+      int min_left = inode_left < block_left ? inode_left : block_left;
 
-      /* Number of bytes to actually copy out of this sector. */
+      /* Number of bytes to actually copy out of this block. */
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Copy the chunk out of the delayed data or the buffer
+         cache.  A hole reads as zeros. */
+      lock_acquire (&inode->inodeLock);
+      pending_idx = offset / BLOCK_SECTOR_SIZE - inode->pending_first;
+      if (pending_idx < inode->pending_cnt)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          memcpy (buffer + bytes_read,
+                  inode->pending + pending_idx * BLOCK_SECTOR_SIZE
+                  + sector_ofs, chunk_size);
+          lock_release (&inode->inodeLock);
         }
-      else 
+      else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          sector_idx = byte_to_sector (inode, offset);
+          lock_release (&inode->inodeLock);
+          if (sector_idx == (block_sector_t) -1)
+            memset (buffer + bytes_read, 0, chunk_size);
+          else
+            cache_read_at (sector_idx, buffer + bytes_read, chunk_size,
+                           sector_ofs);
         }
       
       /* Advance. */
@@ -473,111 +1625,750 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
-
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   A write past end of file extends the inode, leaving any gap
+   between the old end of file and OFFSET as a hole.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+  uint32_t fresh_end = 0;
 
   if (inode->deny_write_cnt)
     return 0;
+  if (is_compressed (inode))
+    return write_compressed (inode, buffer, size, offset);
 
-  // struct inode_disk *inodeDisk;
-  // inodeDisk = malloc( sizeof *inodeDisk );
+  journal_begin ();
+  lock_acquire (&inode->inodeLock);
+  if (is_inline (inode))
+    {
+      /* A write that still fits inline only updates the inode
+         sector.  Bytes past end of file are always zero. */
+      if (offset + size <= (off_t) INODE_INLINE_MAX)
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (offset + size > inode->data.length)
+            inode->data.length = offset + size;
+          journal_write (inode->sector, &inode->data);
+          lock_release (&inode->inodeLock);
+          journal_end ();
+          return size;
+        }
+      if (!promote_inline (inode))
+        {
+          lock_release (&inode->inodeLock);
+          journal_end ();
+          return 0;
+        }
+    }
 
-  // if ( inodeDisk == NULL ) {
-  //   return 0;
-  // }
+  lock_release (&inode->inodeLock);
 
-  // lock_acquire( &inode->inodeLock );
+  while (size > 0) 
+    {
+      /* Sector to write, starting byte offset within sector. */
+      block_sector_t sector_idx;
+      uint32_t file_sector;
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-  // bool extend = false;
+      /* Number of bytes to actually write into this file system
+         block.  Writing past end of file extends it. */
+      int block_left = block_bytes - offset % block_bytes;
+      int chunk_size = size < block_left ? size : block_left;
+
+      /* Allocate the block if it is in a hole or past end of
+         file, unless its allocation can be delayed.  If the disk
+         fills up, write as much as fits. */
+      lock_acquire (&inode->inodeLock);
+      file_sector = offset / BLOCK_SECTOR_SIZE;
+      sector_idx = lookup_sector (inode, file_sector);
+      if ((sector_idx == (block_sector_t) -1
+           || file_sector - inode->pending_first < inode->pending_cnt)
+          && delay_sector (inode, file_sector))
+        {
+          /* Copy the chunk into the delayed data. */
+          memcpy (inode->pending
+                  + (file_sector - inode->pending_first) * BLOCK_SECTOR_SIZE
+                  + sector_ofs, buffer + bytes_written, chunk_size);
+          lock_release (&inode->inodeLock);
+        }
+      else
+        {
+          if (sector_idx == (block_sector_t) -1)
+            {
+              /* Note how far the new run goes, so that its blocks
+                 are not moved again as the write reaches them. */
+              uint32_t hole_end = next_mapped (inode, file_sector);
+
+              sector_idx = fill_hole (inode, offset, size, true);
+              if (sector_idx != (block_sector_t) -1)
+                {
+                  const struct extent *e
+                    = &inode->extents[find_extent (inode, file_sector)];
+                  fresh_end = e->logical + e->length;
+                  if (fresh_end > hole_end)
+                    fresh_end = hole_end;
+                }
+            }
+          else if (!inode->metadata && file_sector >= fresh_end
+                   && (fs_log || free_map_shared (sector_idx)))
+            sector_idx = unshare_block (inode, file_sector,
+                                        chunk_size < block_bytes);
+          lock_release (&inode->inodeLock);
+          if (sector_idx == (block_sector_t) -1)
+            break;
+
+          /* Copy the chunk into the buffer cache.  A partial write
+             reads in the rest of the block first. */
+          if (inode->metadata)
+            journal_write_at (sector_idx, buffer + bytes_written,
+                              chunk_size, sector_ofs);
+          else
+            cache_write_at (sector_idx, buffer + bytes_written, chunk_size,
+                            sector_ofs);
+        }
 
-  // if ( offset + size > inodeDisk->length ) {
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
 
-  //   extend = true;
+  /* Only now make the new data visible past the old end of
+     file. */
+  lock_acquire (&inode->inodeLock);
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      journal_write (inode->sector, &inode->data);
+    }
+  lock_release (&inode->inodeLock);
+  journal_end ();
 
-  //   if ( !extendInodeSize(inodeDisk, offset + size) ) {
-  //     lock_release( &inode->inodeLock );
-  //     free( inodeDisk );
-  //     return 0;
-  //   }
+  return bytes_written;
+}
 
-  // } else {
+/* Queues the blocks holding bytes OFFSET through OFFSET + SIZE
+   of INODE for background read-ahead into the buffer cache.
+   Bytes past end of file are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  lock_acquire (&inode->inodeLock);
+  if (is_inline (inode))
+    end = 0;
+  for (offset = ROUND_DOWN (offset, block_bytes); offset < end;
+       offset += block_bytes)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != (block_sector_t) -1)
+        cache_readahead (sector);
+    }
+  lock_release (&inode->inodeLock);
+}
 
-  //   lock_release( &inode->inodeLock );
+/* Allocates disk sectors for every hole in the SIZE bytes of
+   INODE starting at OFFSET, asking the free map for each hole as
+   a single run, and extends INODE to OFFSET + SIZE bytes if it is
+   shorter.  The new sectors read as zeros.  A compressed file is
+   only extended, since how many sectors its clusters need is not
+   known until they are written.
+   Returns true if successful, false if the arguments are invalid,
+   writes are denied, or the disk or memory is exhausted, in which
+   case some of the sectors may have been allocated anyway. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  uint32_t file_sector;
+  bool success;
+
+  if (offset < 0 || size <= 0 || end < offset || inode->deny_write_cnt)
+    return false;
+
+  journal_begin ();
+  lock_acquire (&inode->inodeLock);
+  success = flush_pending (inode);
+  if (success && is_inline (inode) && end > (off_t) INODE_INLINE_MAX)
+    success = promote_inline (inode);
+  if (success && !is_inline (inode) && !is_compressed (inode))
+    for (file_sector = offset / BLOCK_SECTOR_SIZE;
+         success && file_sector < bytes_to_sectors (end); file_sector++)
+      if (lookup_sector (inode, file_sector) == (block_sector_t) -1)
+        {
+          off_t pos = (off_t) file_sector * BLOCK_SECTOR_SIZE;
+          success = fill_hole (inode, pos, end - pos, false)
+                    != (block_sector_t) -1;
+        }
+  if (success && end > inode->data.length)
+    {
+      inode->data.length = end;
+      journal_write (inode->sector, &inode->data);
+    }
+  lock_release (&inode->inodeLock);
+  journal_end ();
+  return success;
+}
 
-  // }
+/* Sets INODE's length to LENGTH bytes.  Shrinking releases the
+   blocks wholly past the new end of file and zeroes the rest of
+   the last one; growing leaves a hole.
+   Returns true if successful, false if LENGTH is negative, writes
+   are denied, or the disk or memory is exhausted. */
+bool
+inode_truncate (struct inode *inode, off_t length)
+{
+  static char zeros[FS_BLOCK_SECTORS_MAX * BLOCK_SECTOR_SIZE];
+  bool success;
 
-  while (size > 0) 
+  if (length < 0 || inode->deny_write_cnt)
+    return false;
+
+  journal_begin ();
+  lock_acquire (&inode->inodeLock);
+  success = flush_pending (inode);
+  if (success && is_inline (inode))
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      if (length > (off_t) INODE_INLINE_MAX)
+        success = promote_inline (inode);
+      else if (length < inode->data.length)
+        memset (inode->data.inline_data + length, 0,
+                inode->data.length - length);
+    }
+  if (success && is_compressed (inode) && length < inode->data.length)
+    {
+      /* Zero the rest of the last cluster, then drop the ones
+         wholly past the new end of file. */
+      off_t ofs = length % CLUSTER_BYTES;
+      uint32_t keep = DIV_ROUND_UP (length, CLUSTER_BYTES);
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      if (ofs != 0)
+        {
+          success = load_cluster (inode, length / CLUSTER_BYTES);
+          if (success)
+            {
+              memset (inode->cluster + ofs, 0, CLUSTER_BYTES - ofs);
+              success = store_cluster (inode, length / CLUSTER_BYTES);
+            }
+        }
+      if (success)
+        success = truncate_extents (inode, keep * CLUSTER_SECTORS);
+      if (!success || inode->cluster_idx >= keep)
+        inode->cluster_valid = false;
+    }
+  else if (success && !is_inline (inode) && length < inode->data.length)
+    {
+      off_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+      off_t ofs = length % block_bytes;
+      uint32_t file_sector = (length - ofs) / BLOCK_SECTOR_SIZE;
+      block_sector_t sector = (ofs != 0 ? lookup_sector (inode, file_sector)
+                               : (block_sector_t) -1);
+
+      /* The last block is zeroed in place, so first give INODE its
+         own copy if another file shares it. */
+      if (sector != (block_sector_t) -1 && !inode->metadata
+          && free_map_shared (sector))
+        {
+          sector = unshare_block (inode, file_sector, true);
+          success = sector != (block_sector_t) -1;
+        }
+      if (success)
+        success = truncate_extents (inode, (DIV_ROUND_UP (length, block_bytes)
+                                            * fs_block_sectors));
+      if (success && sector != (block_sector_t) -1 && inode->metadata)
+        journal_write_at (sector, zeros, block_bytes - ofs, ofs);
+      else if (success && sector != (block_sector_t) -1)
+        cache_write_at (sector, zeros, block_bytes - ofs, ofs);
+    }
+  if (success)
+    {
+      inode->data.length = length;
+      journal_write (inode->sector, &inode->data);
+    }
+  lock_release (&inode->inodeLock);
+  journal_end ();
+  return success;
+}
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+/* Makes CLONE, a newly created inode that no one else has open,
+   a copy of INODE that shares INODE's data sectors instead of
+   copying them: each shared block gains a reference in the free
+   map, and whichever file writes such a block first gets its own
+   copy of it then.  So cloning costs a write of CLONE's extent
+   map, however much data there is.
+   Returns true if successful, false if INODE is metadata, memory
+   or the disk is exhausted, or one of INODE's blocks is already
+   shared as many times as the free map can count.  Either way,
+   CLONE's extent map holds just the sectors it took references
+   to, so that removing CLONE on failure drops them again. */
+bool
+inode_clone (struct inode *inode, struct inode *clone)
+{
+  size_t i = 0;
+  bool success;
+
+  ASSERT (inode != clone);
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+  journal_begin ();
+  lock_acquire (&inode->inodeLock);
+  lock_acquire (&clone->inodeLock);
+  ASSERT (clone->extent_cnt == 0);
+  success = !inode->metadata && flush_pending (inode);
+  if (success && clone->extent_cap < inode->extent_cnt)
+    {
+      struct extent *extents = realloc (clone->extents, (inode->extent_cnt
+                                                         * sizeof *extents));
+      if (extents == NULL)
+        success = false;
+      else
+        {
+          clone->extents = extents;
+          clone->extent_cap = inode->extent_cnt;
+        }
+    }
+  if (success)
+    {
+      for (i = 0; i < inode->extent_cnt; i++)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          const struct extent *e = &inode->extents[i];
+          if (!free_map_share (e->start, e->length))
+            break;
+          clone->extents[i] = *e;
         }
-      else 
+      clone->extent_cnt = i;
+      success = i == inode->extent_cnt;
+    }
+  if (success)
+    {
+      clone->data.length = inode->data.length;
+      clone->data.flags = inode->data.flags;
+      if (is_inline (inode))
+        memcpy (clone->data.inline_data, inode->data.inline_data,
+                INODE_INLINE_MAX);
+      success = write_extents (clone);
+    }
+  lock_release (&clone->inodeLock);
+  lock_release (&inode->inodeLock);
+  journal_end ();
+  return success;
+}
+
+/* Returns true if another file shares any of INODE's blocks.
+   Caller must hold INODE's lock. */
+static bool
+shares_blocks (const struct inode *inode)
+{
+  size_t i, j;
+
+  for (i = 0; i < inode->extent_cnt; i++)
+    for (j = 0; j < inode->extents[i].length; j += fs_block_sectors)
+      if (free_map_shared (inode->extents[i].start + j))
+        return true;
+  return false;
+}
+
+/* Returns the number of runs of consecutive disk sectors that
+   hold INODE's data.  Extents separated only by a hole count as
+   one run if their disk sectors are consecutive.  Caller must
+   hold INODE's lock. */
+static size_t
+count_runs (const struct inode *inode)
+{
+  size_t runs = 0;
+  size_t i;
+
+  for (i = 0; i < inode->extent_cnt; i++)
+    {
+      const struct extent *e = &inode->extents[i];
+      if (i == 0 || e[-1].start + e[-1].length != e->start)
+        runs++;
+    }
+  return runs;
+}
+
+/* Returns the number of runs of consecutive disk sectors that
+   hold INODE's data.  An unfragmented file has at most one. */
+size_t
+inode_runs (struct inode *inode)
+{
+  size_t runs;
+
+  lock_acquire (&inode->inodeLock);
+  runs = is_inline (inode) ? 0 : count_runs (inode);
+  lock_release (&inode->inodeLock);
+  return runs;
+}
+
+/* Moves INODE's data, if it is split across more than one run of
+   disk sectors, into a single run of free sectors near its inode.
+   The new copy reaches the disk before the new extent map can be
+   committed, and the old sectors are freed only after that.
+   Returns true if INODE's data was moved, false if it did not
+   need to be, if moving it would unshare blocks that another file
+   shares, or if there is no run of free sectors long enough to
+   hold it alongside the old copy. */
+bool
+inode_defrag (struct inode *inode)
+{
+  off_t block_bytes = fs_block_sectors * BLOCK_SECTOR_SIZE;
+  struct extent *old = NULL;
+  uint8_t *buffer = NULL;
+  block_sector_t start, next;
+  size_t total, cnt, i, j;
+  bool moved = false;
+
+  journal_begin ();
+  lock_acquire (&inode->inodeLock);
+  flush_pending (inode);
+  if (is_inline (inode) || count_runs (inode) <= 1 || shares_blocks (inode))
+    goto done;
+
+  total = 0;
+  for (i = 0; i < inode->extent_cnt; i++)
+    total += inode->extents[i].length;
+  cnt = inode->extent_cnt;
+  old = malloc (cnt * sizeof *old);
+  buffer = malloc (block_bytes);
+  if (old == NULL || buffer == NULL
+      || !free_map_allocate_near (total, inode->sector, &start))
+    goto done;
+  memcpy (old, inode->extents, cnt * sizeof *old);
+
+  /* Copy the data, one block at a time, and point the extents at
+     the copy. */
+  next = start;
+  for (i = 0; i < cnt; i++)
+    {
+      struct extent *e = &inode->extents[i];
+      for (j = 0; j < e->length; j += fs_block_sectors)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          cache_read_at (e->start + j, buffer, block_bytes, 0);
+          if (inode->metadata)
+            journal_write_at (next + j, buffer, block_bytes, 0);
+          else
+            cache_write_at (next + j, buffer, block_bytes, 0);
+        }
+      e->start = next;
+      next += e->length;
+    }
+  if (!inode->metadata)
+    cache_flush ();
+
+  /* Extents that were only split on disk are now one. */
+  for (i = j = 0; i < cnt; i++)
+    {
+      struct extent *prev = j > 0 ? &inode->extents[j - 1] : NULL;
+      struct extent *e = &inode->extents[i];
+      if (prev != NULL && prev->logical + prev->length == e->logical)
+        prev->length += e->length;
+      else
+        inode->extents[j++] = *e;
+    }
+  inode->extent_cnt = j;
+  write_extents (inode);
+  if (inode->metadata)
+    for (i = 0; i < cnt; i++)
+      journal_revoke (old[i].start, old[i].length);
+  moved = true;
+
+ done:
+  lock_release (&inode->inodeLock);
+  journal_end ();
+
+  /* The old blocks may be reused only once the new extent map is
+     committed, or a crash could leave the old map pointing to
+     somebody else's data. */
+  if (moved)
+    {
+      journal_commit ();
+      journal_begin ();
+      for (i = 0; i < cnt; i++)
+        free_map_release (old[i].start, old[i].length);
+      journal_end ();
+    }
+  free (buffer);
+  free (old);
+  return moved;
+}
+
+/* Moves the data blocks and overflow blocks of INODE that lie in
+   the CNT disk sectors starting at START elsewhere, which in a
+   log-structured file system is the log head, so that those
+   sectors become free.  INODE's own sector does not move.
+   Returns true if all of them moved, false if the disk or memory
+   is exhausted. */
+bool
+inode_evacuate (struct inode *inode, block_sector_t start, size_t cnt)
+{
+  uint32_t *blocks;
+  size_t block_cnt = 0, i, j;
+  bool success = true;
+
+  journal_begin ();
+  lock_acquire (&inode->inodeLock);
+  flush_pending (inode);
+  blocks = malloc (DIV_ROUND_UP (cnt, fs_block_sectors) * sizeof *blocks);
+  if (blocks == NULL)
+    success = false;
+  else if (!is_inline (inode))
+    {
+      /* Find the file blocks first, since moving them changes the
+         extent map. */
+      for (i = 0; i < inode->extent_cnt; i++)
+        {
+          const struct extent *e = &inode->extents[i];
+          for (j = 0; j < e->length; j += fs_block_sectors)
+            if (e->start + j - start < cnt)
+              blocks[block_cnt++] = e->logical + j;
+        }
+      for (i = 0; i < block_cnt; i++)
+        {
+          block_sector_t old = lookup_sector (inode, blocks[i]);
+          if (relocate_block (inode, blocks[i], true) == old)
+            success = false;
+        }
+
+      for (i = 0; i < inode->overflow_cnt; i++)
+        {
+          block_sector_t old = inode->overflow[i];
+          block_sector_t new;
+
+          if (old - start >= cnt)
+            continue;
+          if (!free_map_allocate (1, &new))
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              success = false;
+              break;
             }
+          inode->overflow[i] = new;
+          write_extents (inode);
+          journal_revoke (old, 1);
+          journal_release (old, 1);
+        }
+    }
+  lock_release (&inode->inodeLock);
+  journal_end ();
+  free (blocks);
+  return success;
+}
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+/* Allocates the delayed data of up to WRITEBACK_BATCH open
+   inodes.  Returns the number of inodes whose data was
+   allocated. */
+size_t
+inode_writeback (void)
+{
+  struct inode *batch[WRITEBACK_BATCH];
+  struct hash_iterator it;
+  size_t cnt = 0, done = 0, i;
+
+  /* Hold each inode open, so that it cannot go away while its
+     data is being written. */
+  lock_acquire (&inode_table_lock);
+  hash_first (&it, &inode_table);
+  while (cnt < WRITEBACK_BATCH && hash_next (&it))
+    {
+      struct inode *inode = hash_entry (hash_cur (&it), struct inode, elem);
+      if (is_dirty (inode))
+        {
+          if (inode->open_cnt++ == 0)
+            {
+              list_remove (&inode->lru_elem);
+              closed_cnt--;
+            }
+          batch[cnt++] = inode;
+        }
+    }
+  lock_release (&inode_table_lock);
+
+  for (i = 0; i < cnt; i++)
+    {
+      journal_begin ();
+      lock_acquire (&batch[i]->inodeLock);
+      if (flush_pending (batch[i]))
+        done++;
+      lock_release (&batch[i]->inodeLock);
+      journal_end ();
+      inode_close (batch[i]);
+    }
+  return done;
+}
+
+/* Writeback thread.  Allocates delayed data every
+   WRITEBACK_INTERVAL ticks, so that it does not sit in memory
+   for long. */
+static void
+writeback_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITEBACK_INTERVAL);
+      inode_writeback ();
+    }
+}
+
+/* Starts the thread that allocates delayed data. */
+void
+inode_start_writeback (void)
+{
+  thread_create ("writeback", PRI_DEFAULT, writeback_daemon, NULL);
+}
+
+/* Takes removed INODE off the orphan list, on disk and in
+   memory. */
+static void
+remove_orphan (struct inode *inode)
+{
+  struct list_elem *prev_elem;
+
+  lock_acquire (&orphan_lock);
+  prev_elem = list_prev (&inode->orphan_elem);
+  if (prev_elem == list_head (&orphans))
+    filesys_set_orphans (inode->data.next_orphan);
+  else
+    {
+      struct inode *prev = list_entry (prev_elem, struct inode, orphan_elem);
+
+      lock_acquire (&prev->inodeLock);
+      prev->data.next_orphan = inode->data.next_orphan;
+      journal_write (prev->sector, &prev->data);
+      lock_release (&prev->inodeLock);
+    }
+  list_remove (&inode->orphan_elem);
+  lock_release (&orphan_lock);
+}
+
+/* Frees removed INODE's data sectors, then its overflow blocks
+   and inode sector, revoking the ones that hold metadata, takes
+   it off the orphan list, and then frees INODE itself.  The data
+   goes RECLAIM_BATCH extents per journal transaction.  Each
+   transaction also records in the inode how many extents are
+   free, so that after a crash, reclaiming the orphan again at
+   mount picks up where this left off instead of freeing sectors
+   twice.  The sectors are released only once the transaction
+   that records this commits, so that none is reused while a
+   crash could still bring back the record that they are in
+   use. */
+static void
+reclaim_inode (struct inode *inode)
+{
+  size_t i = inode->data.reclaimed;
+  size_t cnt;
+
+  while (i < inode->extent_cnt)
+    {
+      journal_begin ();
+      for (cnt = 0; cnt < RECLAIM_BATCH && i < inode->extent_cnt; cnt++, i++)
+        {
+          const struct extent *e = &inode->extents[i];
+
+          if (inode->metadata)
+            journal_revoke (e->start, e->length);
+          journal_release (e->start, e->length);
         }
+      inode->data.reclaimed = i;
+      journal_write (inode->sector, &inode->data);
+      journal_end ();
+    }
 
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
+  /* The inode leaves the orphan list in the same transaction that
+     frees its sector, so that the list never leads to a free
+     sector. */
+  journal_begin ();
+  remove_orphan (inode);
+  for (i = 0; i <= inode->overflow_cnt; i++)
+    {
+      block_sector_t sector = (i < inode->overflow_cnt
+                               ? inode->overflow[i] : inode->sector);
+
+      journal_revoke (sector, 1);
+      journal_release (sector, 1);
     }
+  journal_end ();
+  free_inode (inode);
+}
 
-  // if ( extend ) {
+/* Frees the inodes on the orphan list that starts at inode sector
+   HEAD, which were removed but still open when the system last
+   stopped.  Must be called at mount, after the reclaim thread has
+   started. */
+void
+inode_reclaim_orphans (block_sector_t head)
+{
+  while (head != 0)
+    {
+      struct inode *inode = inode_open (head);
 
-  //   lock_release( &inode->inodeLock );
+      if (inode == NULL)
+        {
+          printf ("inode: can't read orphaned inode %"PRDSNu"\n", head);
+          break;
+        }
+      head = inode->data.next_orphan;
+      lock_acquire (&orphan_lock);
+      list_push_back (&orphans, &inode->orphan_elem);
+      inode->removed = true;
+      lock_release (&orphan_lock);
+      inode_close (inode);
+    }
+}
 
-  // }
+/* Frees the sectors of every removed inode that is waiting for
+   the reclaim thread, and returns once they are all free. */
+void
+inode_reclaim (void)
+{
+  lock_acquire (&reclaimer_lock);
+  for (;;)
+    {
+      struct inode *inode = NULL;
+
+      lock_acquire (&reclaim_lock);
+      if (!list_empty (&reclaim_list))
+        inode = list_entry (list_pop_front (&reclaim_list), struct inode,
+                            lru_elem);
+      lock_release (&reclaim_lock);
+      if (inode == NULL)
+        break;
+      reclaim_inode (inode);
+    }
+  lock_release (&reclaimer_lock);
+}
 
-  free (bounce);
+/* Reclaim thread.  Frees removed inodes' sectors whenever there
+   are any. */
+static void
+reclaim_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      lock_acquire (&reclaim_lock);
+      while (list_empty (&reclaim_list))
+        cond_wait (&reclaim_cond, &reclaim_lock);
+      lock_release (&reclaim_lock);
+      inode_reclaim ();
+    }
+}
 
-  return bytes_written;
+/* Starts the thread that frees removed inodes' sectors. */
+void
+inode_start_reclaim (void)
+{
+  thread_create ("reclaim", PRI_DEFAULT, reclaim_daemon, NULL);
 }
 
 /* Disables writes to INODE.
@@ -600,6 +2391,16 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
+/* Marks INODE as holding file system metadata, so that writes to
+   its data go through the journal.  Returns INODE. */
+struct inode *
+inode_mark_metadata (struct inode *inode)
+{
+  if (inode != NULL)
+    inode->metadata = true;
+  return inode;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
@@ -9,6 +10,7 @@ struct bitmap;
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t);
+bool inode_create_compressed (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
@@ -16,9 +18,22 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+bool inode_allocate (struct inode *, off_t offset, off_t size);
+bool inode_truncate (struct inode *, off_t length);
+bool inode_clone (struct inode *, struct inode *clone);
+size_t inode_runs (struct inode *);
+bool inode_defrag (struct inode *);
+bool inode_evacuate (struct inode *, block_sector_t start, size_t cnt);
+size_t inode_writeback (void);
+void inode_start_writeback (void);
+void inode_reclaim (void);
+void inode_reclaim_orphans (block_sector_t head);
+void inode_start_reclaim (void);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+struct inode *inode_mark_metadata (struct inode *);
 
 void lockInode( struct inode *i );
 void unlockInode( struct inode *i );
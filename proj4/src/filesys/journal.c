@@ -0,0 +1,770 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* The journal is a redo log of file system metadata: inode
+   sectors, overflow blocks, and the data of directories and the
+   free map.  File data is written in place, as before.
+
+   Metadata writes go through journal_write(), which leaves the
+   new contents in the buffer cache and holds the sector there,
+   so that it cannot reach its home location yet.  Every sector
+   written since the last commit belongs to the single running
+   transaction, so updates from many operations are batched
+   together.  A commit writes a copy of each held sector to the
+   log, in one sequential run bracketed by a descriptor and a
+   commit record, and then releases the sectors; the buffer
+   cache writes them home whenever it likes.
+
+   Operations that must not be split across transactions are
+   bracketed by journal_begin() and journal_end().  A commit
+   waits until no such handles are open, and while it waits no
+   new operation may begin, so that a steady stream of operations
+   cannot put it off for ever.  The one exception is a
+   write that finds the transaction full: it commits at once,
+   handles or not, and then retries, so an operation may be split
+   but no metadata ever bypasses the log.
+
+   A metadata sector that is freed may be reused for file data,
+   which is written in place.  An older copy of the sector in the
+   log must then not be replayed over that data, so freeing
+   metadata revokes the sector with journal_revoke().  Replay
+   skips a logged copy that was revoked by the same or a later
+   transaction.  Writing the sector as metadata again cancels the
+   revocation.
+
+   A block that metadata stops pointing to must not be reused
+   before that change commits, or a crash could leave the old
+   metadata pointing to another file's data.  journal_release()
+   defers freeing such a block until the running transaction has
+   committed.  A forced commit may happen while the free map is
+   locked, so only the next ordinary commit frees the blocks.
+
+   The buffer cache holds whole file system blocks, so a commit
+   logs every sector of each held block, and revocations cover
+   whole blocks too.
+
+   File data is not logged, but a transaction that allocates
+   blocks flushes dirty file data before its commit record, so
+   that after a crash no committed inode points to a block that
+   was never written.
+
+   The log is reused from the start once it runs low on space.
+   Before that, a checkpoint writes every dirty sector home, so
+   nothing in the old log is needed any more.  At startup,
+   journal_init() replays every complete transaction in the log
+   and then checkpoints.
+
+   On disk, the journal region starts at JOURNAL_SECTOR with a
+   header, followed by LOG_SECTORS sectors of log.  A transaction
+   in the log is a descriptor, a copy of each logged sector, the
+   revoke blocks, and a commit record. */
+
+#define JOURNAL_MAGIC 0x4a524e4c        /* Header. */
+#define DESC_MAGIC 0x4a444553           /* Transaction descriptor. */
+#define COMMIT_MAGIC 0x4a434d54         /* Transaction commit record. */
+
+/* Number of sectors in the log proper. */
+#define LOG_SECTORS (JOURNAL_SECTORS - 1)
+
+/* Most blocks in one transaction, and most sectors, which one
+   descriptor must be able to list and two transactions must fit
+   in the log.  The smaller of the two applies, and at most half
+   of the buffer cache.  journal_end() commits without waiting
+   for the timer once half of the limit is in use. */
+#define TXN_MAX_BLOCKS 64
+#define TXN_MAX 120
+
+/* Revoked runs of sectors per revoke block, revoke blocks per
+   transaction, and the number of runs at which journal_end()
+   commits without waiting for the timer. */
+#define REVOKES_PER_BLOCK 64
+#define REVOKE_BLOCKS 2
+#define REVOKE_MAX (REVOKES_PER_BLOCK * REVOKE_BLOCKS)
+#define REVOKE_COMMIT_THRESHOLD (REVOKE_MAX * 3 / 4)
+
+/* Most log sectors one transaction can take. */
+#define TXN_LOG_MAX (TXN_MAX + REVOKE_BLOCKS + 2)
+
+/* Ticks between background commits. */
+#define COMMIT_INTERVAL (TIMER_FREQ / 2)
+
+/* Journal header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Sequence number of first
+                                           transaction in the log. */
+    uint32_t unused[126];               /* Not used. */
+  };
+
+/* First sector of a logged transaction, followed by a copy of
+   each of its SECTORS and then a commit record.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_desc
+  {
+    unsigned magic;                     /* DESC_MAGIC or COMMIT_MAGIC. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Number of logged sectors. */
+    uint32_t revoke_cnt;                /* Number of revoked runs. */
+    block_sector_t sectors[124];        /* Home sectors, if DESC_MAGIC. */
+  };
+
+/* A run of revoked sectors. */
+struct revoke
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+    uint32_t seq;                       /* Transaction, during replay. */
+  };
+
+/* On-disk form of a run of revoked sectors. */
+struct revoke_disk
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+static bool active;                     /* Logging metadata? */
+static uint32_t next_seq;               /* Next transaction's number. */
+static size_t log_head;                 /* Next free log sector. */
+static size_t max_held;                 /* Transaction size limit. */
+
+/* Sectors revoked by the running transaction. */
+static struct revoke revokes[REVOKE_MAX];
+static size_t revoke_cnt;
+static bool revoke_overflow;            /* Some revocations lost? */
+
+/* Sectors to release once the running transaction commits. */
+static struct free_run *deferred;
+static size_t deferred_cnt;
+static size_t deferred_cap;             /* Allocated size of DEFERRED. */
+
+static int handle_cnt;                  /* Open handles. */
+static int writer_cnt;                  /* Journal writes under way. */
+static int commit_waiters;              /* Commits waiting for handles. */
+static bool order_data;                 /* Flush file data before commit? */
+static bool committing;                 /* Commit in progress? */
+static struct lock journal_lock;        /* Protects the above. */
+static struct condition journal_idle;   /* Handles or commit done. */
+
+/* Statistics. */
+static unsigned long long commit_cnt;   /* Transactions committed. */
+static unsigned long long logged_cnt;   /* Sectors logged. */
+static unsigned long long checkpoint_cnt; /* Checkpoints. */
+
+static thread_func commit_daemon;
+static void commit (bool forced);
+static void write_header (void);
+static void cancel_revoke (block_sector_t);
+
+/* Returns the disk sector of log sector POS. */
+static block_sector_t
+log_sector (size_t pos)
+{
+  return JOURNAL_SECTOR + 1 + pos;
+}
+
+/* Writes an empty journal, as part of formatting the file
+   system. */
+void
+journal_format (void)
+{
+  next_seq = 1;
+  write_header ();
+}
+
+/* Returns the number of revoke blocks needed for CNT revoked
+   runs. */
+static size_t
+revoke_blocks (size_t cnt)
+{
+  return DIV_ROUND_UP (cnt, REVOKES_PER_BLOCK);
+}
+
+/* Reads the transaction with sequence number SEQ that starts at
+   log sector POS into D, and its revoke blocks into REVOKED,
+   which must have room for REVOKE_MAX runs.
+   Returns true if the whole transaction, through its commit
+   record, is in the log, false otherwise. */
+static bool
+read_txn (size_t pos, uint32_t seq, struct journal_desc *d,
+          struct revoke_disk *revoked)
+{
+  struct journal_desc *c;
+  size_t rb;
+  bool complete = false;
+
+  block_read (fs_device, log_sector (pos), d);
+  if (d->magic != DESC_MAGIC || d->seq != seq
+      || d->cnt > TXN_MAX || d->revoke_cnt > REVOKE_MAX)
+    return false;
+  rb = revoke_blocks (d->revoke_cnt);
+  if (pos + d->cnt + rb + 2 > LOG_SECTORS)
+    return false;
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    PANIC ("journal allocation failed");
+  block_read (fs_device, log_sector (pos + d->cnt + rb + 1), c);
+  if (c->magic == COMMIT_MAGIC && c->seq == seq && c->cnt == d->cnt)
+    {
+      block_read_multi (fs_device, log_sector (pos + d->cnt + 1), rb,
+                        revoked);
+      complete = true;
+    }
+  free (c);
+  return complete;
+}
+
+/* Returns true if a copy of SECTOR logged by transaction SEQ must
+   not be replayed, because one of the CNT runs in REVOKED, from
+   transaction SEQ or later, covers it. */
+static bool
+is_revoked (const struct revoke *revoked, size_t cnt,
+            block_sector_t sector, uint32_t seq)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (revoked[i].seq >= seq && sector >= revoked[i].start
+        && sector - revoked[i].start < revoked[i].length)
+      return true;
+  return false;
+}
+
+/* Replays the journal, then starts logging metadata. */
+void
+journal_init (void)
+{
+  struct journal_header *h;
+  struct journal_desc *d;
+  struct revoke_disk *rd;
+  struct revoke *revoked = NULL;
+  size_t revoked_cnt = 0;
+  uint8_t *data;
+  uint32_t first_seq;
+  size_t pos;
+
+  ASSERT (sizeof *h == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof *d == BLOCK_SECTOR_SIZE);
+  ASSERT (TXN_MAX <= sizeof d->sectors / sizeof *d->sectors);
+  ASSERT (2 * TXN_LOG_MAX <= LOG_SECTORS);
+  ASSERT (REVOKES_PER_BLOCK * sizeof *rd == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_idle);
+  handle_cnt = 0;
+  writer_cnt = 0;
+  commit_waiters = 0;
+  order_data = false;
+  committing = false;
+  revoke_cnt = 0;
+  revoke_overflow = false;
+  deferred = NULL;
+  deferred_cnt = deferred_cap = 0;
+
+  h = malloc (sizeof *h);
+  d = malloc (sizeof *d);
+  rd = malloc (REVOKE_BLOCKS * BLOCK_SECTOR_SIZE);
+  data = malloc (BLOCK_SECTOR_SIZE);
+  if (h == NULL || d == NULL || rd == NULL || data == NULL)
+    PANIC ("journal allocation failed");
+
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != JOURNAL_MAGIC)
+    PANIC ("no journal found--file system must be formatted");
+  first_seq = next_seq = h->seq;
+
+  /* First pass: find the complete transactions, stopping at the
+     first incomplete one, and gather their revocations. */
+  for (pos = 0; read_txn (pos, next_seq, d, rd); next_seq++)
+    {
+      struct revoke *r = realloc (revoked, ((revoked_cnt + d->revoke_cnt)
+                                            * sizeof *revoked));
+      size_t i;
+
+      if (r == NULL && d->revoke_cnt > 0)
+        PANIC ("journal allocation failed");
+      revoked = r;
+      for (i = 0; i < d->revoke_cnt; i++)
+        {
+          revoked[revoked_cnt].start = rd[i].start;
+          revoked[revoked_cnt].length = rd[i].length;
+          revoked[revoked_cnt].seq = next_seq;
+          revoked_cnt++;
+        }
+      pos += d->cnt + revoke_blocks (d->revoke_cnt) + 2;
+    }
+
+  /* Second pass: redo them in order. */
+  pos = 0;
+  for (next_seq = first_seq; read_txn (pos, next_seq, d, rd); next_seq++)
+    {
+      size_t i;
+
+      for (i = 0; i < d->cnt; i++)
+        if (!is_revoked (revoked, revoked_cnt, d->sectors[i], next_seq))
+          {
+            block_read (fs_device, log_sector (pos + 1 + i), data);
+            cache_write (d->sectors[i], data);
+          }
+      pos += d->cnt + revoke_blocks (d->revoke_cnt) + 2;
+    }
+  if (next_seq != first_seq)
+    printf ("journal: replayed %"PRIu32" transactions\n",
+            next_seq - first_seq);
+
+  /* Put replayed sectors in their home locations and start over
+     with an empty log. */
+  cache_flush ();
+  write_header ();
+
+  free (revoked);
+  free (data);
+  free (rd);
+  free (d);
+  free (h);
+
+  max_held = cache_capacity () / 2;
+  if (max_held > TXN_MAX_BLOCKS * fs_block_sectors)
+    max_held = TXN_MAX_BLOCKS * fs_block_sectors;
+  if (max_held > TXN_MAX)
+    max_held = TXN_MAX;
+  ASSERT (max_held >= fs_block_sectors);
+  active = true;
+  thread_create ("jcommit", PRI_DEFAULT, commit_daemon, NULL);
+}
+
+/* Commits the running transaction, checkpoints, and stops
+   logging.  Releasing deferred sectors after a commit starts
+   another transaction, so commits until one leaves nothing
+   behind. */
+void
+journal_done (void)
+{
+  for (;;)
+    {
+      journal_commit ();
+      lock_acquire (&journal_lock);
+      while (committing || writer_cnt > 0 || handle_cnt > 0)
+        cond_wait (&journal_idle, &journal_lock);
+      if (cache_held_cnt () == 0 && revoke_cnt == 0 && deferred_cnt == 0)
+        break;
+      lock_release (&journal_lock);
+    }
+  active = false;
+  lock_release (&journal_lock);
+  cache_flush ();
+  write_header ();
+}
+
+/* Opens a handle, which keeps every journal write until the
+   matching journal_end() in the same transaction.  Handles may
+   nest.  An outermost handle waits for a pending commit. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!active)
+    return;
+  lock_acquire (&journal_lock);
+  if (t->journal_depth++ == 0)
+    while (committing || commit_waiters > 0)
+      cond_wait (&journal_idle, &journal_lock);
+  handle_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Closes a handle opened by journal_begin().  Commits the running
+   transaction if it is getting large. */
+void
+journal_end (void)
+{
+  bool commit;
+
+  if (!active)
+    return;
+  lock_acquire (&journal_lock);
+  ASSERT (handle_cnt > 0);
+  thread_current ()->journal_depth--;
+  commit = (--handle_cnt == 0
+            && (cache_held_cnt () >= max_held / 2
+                || revoke_cnt >= REVOKE_COMMIT_THRESHOLD));
+  if (handle_cnt == 0)
+    cond_broadcast (&journal_idle, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (commit)
+    journal_commit ();
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes of metadata from BUFFER into
+   SECTOR as part of the running transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes of metadata from BUFFER into SECTOR starting
+   at byte OFFSET, as part of the running transaction.  If the
+   transaction is full, commits it, even with handles open, and
+   writes into the next one. */
+void
+journal_write_at (block_sector_t sector, const void *buffer,
+                  off_t size, off_t offset)
+{
+  if (!active)
+    {
+      cache_write_at (sector, buffer, size, offset);
+      return;
+    }
+
+  for (;;)
+    {
+      bool held;
+
+      lock_acquire (&journal_lock);
+      while (committing)
+        cond_wait (&journal_idle, &journal_lock);
+      writer_cnt++;
+      lock_release (&journal_lock);
+
+      held = cache_write_held_at (sector, buffer, size, offset, max_held);
+      if (held)
+        {
+          /* The whole block will be logged. */
+          block_sector_t first = sector - sector % fs_block_sectors;
+          unsigned i;
+
+          for (i = 0; i < fs_block_sectors; i++)
+            cancel_revoke (first + i);
+        }
+
+      lock_acquire (&journal_lock);
+      if (--writer_cnt == 0)
+        cond_broadcast (&journal_idle, &journal_lock);
+      lock_release (&journal_lock);
+
+      if (held)
+        break;
+      commit (true);
+    }
+}
+
+/* Notes that the running transaction allocates blocks, which
+   may then be written with file data, so that commit writes
+   dirty file data home before its commit record. */
+void
+journal_order_data (void)
+{
+  if (!active)
+    return;
+  lock_acquire (&journal_lock);
+  order_data = true;
+  lock_release (&journal_lock);
+}
+
+/* Removes SECTOR from the running transaction's revocations.
+   Caller must not hold journal_lock. */
+static void
+cancel_revoke (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < revoke_cnt; i++)
+    {
+      struct revoke *r = &revokes[i];
+      if (sector >= r->start && sector - r->start < r->length)
+        {
+          block_sector_t end = r->start + r->length;
+
+          /* Keep the part before SECTOR in R and move the part
+             after it, if any, to a new run. */
+          r->length = sector - r->start;
+          if (end > sector + 1)
+            {
+              if (revoke_cnt < REVOKE_MAX)
+                {
+                  revokes[revoke_cnt].start = sector + 1;
+                  revokes[revoke_cnt].length = end - (sector + 1);
+                  revoke_cnt++;
+                }
+              else
+                revoke_overflow = true;
+            }
+          if (r->length == 0)
+            *r = revokes[--revoke_cnt];
+          break;
+        }
+    }
+  lock_release (&journal_lock);
+}
+
+/* Records that the CNT metadata sectors starting at START are
+   being freed by the running transaction, so that copies of them
+   already in the log are not replayed. */
+void
+journal_revoke (block_sector_t start, size_t cnt)
+{
+  block_sector_t end = ROUND_UP (start + cnt, fs_block_sectors);
+  size_t i;
+
+  if (!active || cnt == 0)
+    return;
+
+  /* Whole blocks are logged, so revoke whole blocks. */
+  start = ROUND_DOWN (start, fs_block_sectors);
+  cnt = end - start;
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_idle, &journal_lock);
+  for (i = 0; i < revoke_cnt; i++)
+    if (revokes[i].start + revokes[i].length == start)
+      {
+        revokes[i].length += cnt;
+        break;
+      }
+  if (i == revoke_cnt)
+    {
+      if (revoke_cnt < REVOKE_MAX)
+        {
+          revokes[revoke_cnt].start = start;
+          revokes[revoke_cnt].length = cnt;
+          revoke_cnt++;
+        }
+      else
+        revoke_overflow = true;
+    }
+  lock_release (&journal_lock);
+}
+
+/* Releases the CNT sectors starting at SECTOR in the free map
+   once the running transaction commits. */
+void
+journal_release (block_sector_t sector, size_t cnt)
+{
+  if (!active)
+    {
+      free_map_release (sector, cnt);
+      return;
+    }
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_idle, &journal_lock);
+  if (deferred_cnt == deferred_cap)
+    {
+      size_t cap = deferred_cap > 0 ? deferred_cap * 2 : 16;
+      struct free_run *d = realloc (deferred, cap * sizeof *deferred);
+      if (d == NULL)
+        PANIC ("journal allocation failed");
+      deferred = d;
+      deferred_cap = cap;
+    }
+  deferred[deferred_cnt].start = sector;
+  deferred[deferred_cnt].cnt = cnt;
+  deferred_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Releases the CNT runs in RUNS, taken from DEFERRED after the
+   transactions that stopped using them committed, and frees
+   RUNS.  The handle is opened before the free map is locked, as
+   everywhere else. */
+static void
+release_deferred (struct free_run *runs, size_t cnt)
+{
+  if (cnt > 0)
+    {
+      journal_begin ();
+      free_map_release_runs (runs, cnt);
+      journal_end ();
+    }
+  free (runs);
+}
+
+/* Writes the journal header, marking the log as empty. */
+static void
+write_header (void)
+{
+  struct journal_header *h = calloc (1, sizeof *h);
+  if (h == NULL)
+    PANIC ("journal allocation failed");
+  h->magic = JOURNAL_MAGIC;
+  h->seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, h);
+  free (h);
+  log_head = 0;
+}
+
+/* Writes every dirty sector home and empties the log. */
+static void
+checkpoint (void)
+{
+  cache_flush ();
+  write_header ();
+  checkpoint_cnt++;
+}
+
+/* Logs the running transaction and starts a new one.  Waits for
+   open handles to close first. */
+void
+journal_commit (void)
+{
+  commit (false);
+}
+
+/* Logs the running transaction and starts a new one.  Waits for
+   journal writes under way to finish and, unless FORCED, for open
+   handles to close. */
+static void
+commit (bool forced)
+{
+  const void **buffers;
+  struct free_run *released = NULL;
+  size_t released_cnt = 0;
+  struct journal_desc *d;
+  struct revoke_disk *rd;
+  uint8_t *data;
+  size_t rb, i;
+  size_t pos;
+  bool ordered;
+
+  lock_acquire (&journal_lock);
+  if (!forced)
+    commit_waiters++;
+  while (committing || writer_cnt > 0 || (!forced && handle_cnt > 0))
+    cond_wait (&journal_idle, &journal_lock);
+  if (!forced)
+    {
+      /* Whatever was deferred so far is released once this commit
+         is done, or right away if earlier commits took care of
+         everything. */
+      commit_waiters--;
+      released = deferred;
+      released_cnt = deferred_cnt;
+      deferred = NULL;
+      deferred_cnt = deferred_cap = 0;
+    }
+  if (!active || (cache_held_cnt () == 0 && revoke_cnt == 0))
+    {
+      cond_broadcast (&journal_idle, &journal_lock);
+      lock_release (&journal_lock);
+      release_deferred (released, released_cnt);
+      return;
+    }
+  committing = true;
+  ordered = order_data;
+  order_data = false;
+  lock_release (&journal_lock);
+
+  d = calloc (1, sizeof *d);
+  rd = calloc (REVOKE_BLOCKS, BLOCK_SECTOR_SIZE);
+  data = malloc (TXN_MAX * BLOCK_SECTOR_SIZE);
+  buffers = malloc (TXN_LOG_MAX * sizeof *buffers);
+  if (d == NULL || rd == NULL || data == NULL || buffers == NULL)
+    PANIC ("journal allocation failed");
+
+  /* Write the descriptor, the sectors, the revoke blocks and the
+     commit record, in that order, in consecutive log sectors.
+     All but the commit record go out in a single write, which
+     must be complete before the commit record is written. */
+  d->magic = DESC_MAGIC;
+  d->seq = next_seq;
+  d->cnt = cache_held_sectors (d->sectors, TXN_MAX);
+  d->revoke_cnt = revoke_cnt;
+  rb = revoke_blocks (revoke_cnt);
+  ASSERT (log_head + d->cnt + rb + 2 <= LOG_SECTORS);
+
+  pos = 0;
+  buffers[pos++] = d;
+  for (i = 0; i < d->cnt; i++)
+    {
+      cache_read (d->sectors[i], data + i * BLOCK_SECTOR_SIZE);
+      buffers[pos++] = data + i * BLOCK_SECTOR_SIZE;
+    }
+  for (i = 0; i < revoke_cnt; i++)
+    {
+      rd[i].start = revokes[i].start;
+      rd[i].length = revokes[i].length;
+    }
+  for (i = 0; i < rb; i++)
+    buffers[pos++] = rd + i * REVOKES_PER_BLOCK;
+  block_write_sg (fs_device, log_sector (log_head), buffers, pos);
+  pos += log_head;
+
+  /* Blocks allocated by the transaction must hold their data
+     before the metadata that points to them is committed.  Held
+     sectors are not written home. */
+  if (ordered)
+    cache_flush ();
+
+  d->magic = COMMIT_MAGIC;
+  d->revoke_cnt = 0;
+  memset (d->sectors, 0, sizeof d->sectors);
+  block_write (fs_device, log_sector (pos++), d);
+
+  log_head = pos;
+  next_seq++;
+  commit_cnt++;
+  logged_cnt += d->cnt;
+  revoke_cnt = 0;
+  cache_release_held ();
+
+  /* Make sure that the next transaction will fit.  If some
+     revocations did not fit in this one, get rid of the copies
+     they should have covered. */
+  if (log_head + TXN_LOG_MAX > LOG_SECTORS || revoke_overflow)
+    {
+      revoke_overflow = false;
+      checkpoint ();
+    }
+
+  free (buffers);
+  free (data);
+  free (rd);
+  free (d);
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&journal_idle, &journal_lock);
+  lock_release (&journal_lock);
+
+  release_deferred (released, released_cnt);
+}
+
+/* Commit thread.  Commits the running transaction every
+   COMMIT_INTERVAL ticks. */
+static void
+commit_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      journal_commit ();
+    }
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu commits, %llu sectors logged, %llu checkpoints\n",
+          commit_cnt, logged_cnt, checkpoint_cnt);
+}
@@ -0,0 +1,27 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Number of sectors in the journal region, starting at
+   JOURNAL_SECTOR: a header followed by the log. */
+#define JOURNAL_SECTORS 256
+
+void journal_format (void);
+void journal_init (void);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *);
+void journal_write_at (block_sector_t, const void *, off_t size, off_t offset);
+void journal_revoke (block_sector_t, size_t cnt);
+void journal_release (block_sector_t, size_t cnt);
+void journal_order_data (void);
+void journal_commit (void);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,212 @@
+#include "filesys/lz.h"
+#include <stdbool.h>
+#include <string.h>
+#include "threads/malloc.h"
+
+/* A small LZ77 codec in the style of LZ4, fast enough that
+   compressing a cluster costs far less than transferring the
+   sectors it saves.
+
+   Compressed data is a sequence of records, each a token byte
+   followed by literals and then a match.  The token's high 4 bits
+   give the number of literals and its low 4 bits the match length
+   less LZ_MIN_MATCH; a field of 15 continues in the following
+   bytes, each adding up to 255, until one is less than 255.  The
+   literals come next, then, except in the last record, the
+   match: a 2-byte little-endian distance back into the output,
+   and any continuation bytes of its length.  A match may overlap
+   the bytes it produces, so a run of one byte compresses to a
+   single match. */
+
+/* Shortest match worth encoding. */
+#define LZ_MIN_MATCH 4
+
+/* Farthest back a match can start. */
+#define LZ_MAX_DISTANCE 0xffff
+
+/* The compressor finds matches through a hash table of the most
+   recent position of each 4-byte sequence, with 1 << LZ_HASH_BITS
+   entries. */
+#define LZ_HASH_BITS 9
+#define LZ_NO_POS ((size_t) -1)
+
+/* Returns the 4 bytes at P as an integer. */
+static uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+/* Returns the hash table slot for the 4 bytes at P. */
+static size_t
+hash_at (const uint8_t *p)
+{
+  return (read32 (p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Output buffer for the compressor. */
+struct output
+  {
+    uint8_t *p;                 /* Next byte to write. */
+    uint8_t *end;               /* End of buffer. */
+  };
+
+/* Appends the continuation bytes for a length field whose token
+   nibble is 15, for a field value of N.  Returns false if OUT is
+   full. */
+static bool
+put_length (struct output *out, size_t n)
+{
+  for (n -= 15; ; n -= 255)
+    {
+      if (out->p == out->end)
+        return false;
+      *out->p++ = n < 255 ? n : 255;
+      if (n < 255)
+        return true;
+    }
+}
+
+/* Appends a record with the LIT_CNT literals at LIT and a match
+   of MATCH_LEN bytes DISTANCE back, or no match if MATCH_LEN is
+   0.  Returns false if OUT is full. */
+static bool
+put_record (struct output *out, const uint8_t *lit, size_t lit_cnt,
+            size_t distance, size_t match_len)
+{
+  size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+  if (out->p == out->end)
+    return false;
+  *out->p++ = ((lit_cnt < 15 ? lit_cnt : 15) << 4
+               | (match_code < 15 ? match_code : 15));
+  if (lit_cnt >= 15 && !put_length (out, lit_cnt))
+    return false;
+  if ((size_t) (out->end - out->p) < lit_cnt)
+    return false;
+  memcpy (out->p, lit, lit_cnt);
+  out->p += lit_cnt;
+
+  if (match_len > 0)
+    {
+      if (out->end - out->p < 2)
+        return false;
+      *out->p++ = distance & 0xff;
+      *out->p++ = distance >> 8;
+      if (match_code >= 15 && !put_length (out, match_code))
+        return false;
+    }
+  return true;
+}
+
+/* Compresses the SRC_LEN bytes at SRC into the DST_CAP bytes at
+   DST.  Returns the number of bytes of compressed data, or 0 if
+   it would not fit in DST_CAP bytes or memory is exhausted. */
+size_t
+lz_compress (const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap)
+{
+  struct output out;
+  size_t *table;
+  size_t pos, anchor, i;
+  bool ok = true;
+
+  table = malloc (sizeof *table << LZ_HASH_BITS);
+  if (table == NULL)
+    return 0;
+  for (i = 0; i < (size_t) 1 << LZ_HASH_BITS; i++)
+    table[i] = LZ_NO_POS;
+
+  out.p = dst;
+  out.end = dst + dst_cap;
+  pos = anchor = 0;
+  while (ok && pos + LZ_MIN_MATCH <= src_len)
+    {
+      size_t h = hash_at (src + pos);
+      size_t cand = table[h];
+
+      table[h] = pos;
+      if (cand != LZ_NO_POS && pos - cand <= LZ_MAX_DISTANCE
+          && read32 (src + cand) == read32 (src + pos))
+        {
+          size_t len = LZ_MIN_MATCH;
+          while (pos + len < src_len && src[cand + len] == src[pos + len])
+            len++;
+          ok = put_record (&out, src + anchor, pos - anchor, pos - cand, len);
+          pos += len;
+          anchor = pos;
+        }
+      else
+        pos++;
+    }
+  if (ok)
+    ok = put_record (&out, src + anchor, src_len - anchor, 0, 0);
+  free (table);
+  return ok ? (size_t) (out.p - dst) : 0;
+}
+
+/* Reads a length field whose token nibble is NIBBLE from *P, not
+   going past END, and returns its value.  Sets *OK to false if
+   the field runs past END. */
+static size_t
+get_length (const uint8_t **p, const uint8_t *end, size_t nibble, bool *ok)
+{
+  size_t n = nibble;
+
+  if (nibble == 15)
+    for (;;)
+      {
+        uint8_t b;
+        if (*p == end)
+          {
+            *ok = false;
+            break;
+          }
+        b = *(*p)++;
+        n += b;
+        if (b < 255)
+          break;
+      }
+  return n;
+}
+
+/* Decompresses the SRC_LEN bytes of compressed data at SRC into
+   the DST_CAP bytes at DST.  Returns the number of bytes produced,
+   or 0 if the data is corrupt or does not fit in DST_CAP bytes. */
+size_t
+lz_decompress (const uint8_t *src, size_t src_len, uint8_t *dst,
+               size_t dst_cap)
+{
+  const uint8_t *p = src, *end = src + src_len;
+  size_t out = 0;
+  bool ok = true;
+
+  while (p < end)
+    {
+      uint8_t token = *p++;
+      size_t lit_cnt = get_length (&p, end, token >> 4, &ok);
+      size_t distance, len;
+
+      if (!ok || (size_t) (end - p) < lit_cnt || dst_cap - out < lit_cnt)
+        return 0;
+      memcpy (dst + out, p, lit_cnt);
+      p += lit_cnt;
+      out += lit_cnt;
+      if (p == end)
+        break;
+
+      /* Copy the match a byte at a time, since it may overlap the
+         bytes it produces. */
+      if (end - p < 2)
+        return 0;
+      distance = p[0] | (p[1] << 8);
+      p += 2;
+      len = get_length (&p, end, token & 15, &ok) + LZ_MIN_MATCH;
+      if (!ok || distance == 0 || distance > out || dst_cap - out < len)
+        return 0;
+      for (; len > 0; len--, out++)
+        dst[out] = dst[out - distance];
+    }
+  return out;
+}
@@ -0,0 +1,12 @@
+#ifndef FILESYS_LZ_H
+#define FILESYS_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+size_t lz_compress (const uint8_t *src, size_t src_len,
+                    uint8_t *dst, size_t dst_cap);
+size_t lz_decompress (const uint8_t *src, size_t src_len,
+                      uint8_t *dst, size_t dst_cap);
+
+#endif /* filesys/lz.h */
@@ -0,0 +1,474 @@
+#include "filesys/tmpfs.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/vfs.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A tmpfs keeps its files' data in kernel pages instead of on
+   the disk, so that reading and writing them never waits for the
+   disk, and they are gone at shutdown.  Like the disk's file
+   system, it has a single directory, here its mount point.
+
+   A file gets a page for each PGSIZE bytes of it that are
+   written; the rest is a hole and reads as zeros.  A tmpfs uses
+   at most the number of pages given when it is mounted for data;
+   writes past that fail as if the disk were full. */
+
+/* A mounted tmpfs. */
+struct tmpfs
+  {
+    struct list files;                  /* Files, in creation order. */
+    struct tmpfs_node *root;            /* Its directory. */
+    struct lock lock;                   /* Protects all of the above. */
+    size_t used_pages;                  /* Pages holding data. */
+    size_t max_pages;                   /* Limit on USED_PAGES. */
+    int next_inumber;                   /* Next node number to use. */
+  };
+
+/* A file, or the directory, in a tmpfs. */
+struct tmpfs_node
+  {
+    struct list_elem elem;              /* Element in its tmpfs's FILES. */
+    struct tmpfs *fs;                   /* Its tmpfs. */
+    char name[NAME_MAX + 1];            /* File name, "" for the directory. */
+    bool is_dir;                        /* Is it the directory? */
+    int inumber;                        /* Node number. */
+    int open_cnt;                       /* Number of openers. */
+    bool removed;                       /* Removed from FS's FILES? */
+    int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t length;                       /* File size in bytes. */
+    uint8_t **pages;                    /* PAGE_CNT pages, each maybe null. */
+    size_t page_cnt;                    /* Number of elements in PAGES. */
+  };
+
+static const struct vfs_file_ops tmpfs_file_ops;
+static const struct vfs_dir_ops tmpfs_dir_ops;
+
+/* Returns a new node named NAME in FS, which is a directory if
+   IS_DIR is true, or a null pointer if memory is exhausted. */
+static struct tmpfs_node *
+new_node (struct tmpfs *fs, const char *name, bool is_dir)
+{
+  struct tmpfs_node *node = calloc (1, sizeof *node);
+
+  if (node != NULL)
+    {
+      node->fs = fs;
+      strlcpy (node->name, name, sizeof node->name);
+      node->is_dir = is_dir;
+      node->inumber = fs->next_inumber++;
+    }
+  return node;
+}
+
+/* Frees NODE and its pages.  Caller must hold its tmpfs's
+   lock. */
+static void
+free_node (struct tmpfs_node *node)
+{
+  size_t i;
+
+  for (i = 0; i < node->page_cnt; i++)
+    if (node->pages[i] != NULL)
+      {
+        palloc_free_page (node->pages[i]);
+        node->fs->used_pages--;
+      }
+  free (node->pages);
+  free (node);
+}
+
+/* Returns the file in FS named NAME, or a null pointer if there
+   is none.  Caller must hold FS's lock. */
+static struct tmpfs_node *
+find (struct tmpfs *fs, const char *name)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&fs->files); e != list_end (&fs->files);
+       e = list_next (e))
+    {
+      struct tmpfs_node *node = list_entry (e, struct tmpfs_node, elem);
+      if (!strcmp (node->name, name))
+        return node;
+    }
+  return NULL;
+}
+
+/* Makes NODE's page array at least CNT pages long.  Returns true
+   if successful, false if memory is exhausted.  Caller must hold
+   NODE's tmpfs's lock. */
+static bool
+reserve_pages (struct tmpfs_node *node, size_t cnt)
+{
+  uint8_t **pages;
+
+  if (cnt <= node->page_cnt)
+    return true;
+  pages = realloc (node->pages, cnt * sizeof *pages);
+  if (pages == NULL)
+    return false;
+  memset (pages + node->page_cnt, 0,
+          (cnt - node->page_cnt) * sizeof *pages);
+  node->pages = pages;
+  node->page_cnt = cnt;
+  return true;
+}
+
+/* Returns page IDX of NODE, allocating it if it is a hole.
+   Returns a null pointer if memory is exhausted or NODE's tmpfs
+   has used all of its pages.  Caller must hold NODE's tmpfs's
+   lock. */
+static uint8_t *
+get_page (struct tmpfs_node *node, size_t idx)
+{
+  struct tmpfs *fs = node->fs;
+
+  if (!reserve_pages (node, idx + 1))
+    return NULL;
+  if (node->pages[idx] == NULL && fs->used_pages < fs->max_pages)
+    {
+      node->pages[idx] = palloc_get_page (PAL_ZERO);
+      if (node->pages[idx] != NULL)
+        fs->used_pages++;
+    }
+  return node->pages[idx];
+}
+
+/* Names. */
+
+/* Returns NAME as a name in a tmpfs.  A tmpfs mounted at the root
+   is handed whole names, so a leading "/" is dropped, and "."
+   names the directory, as does "". */
+static const char *
+local_name (const char *name)
+{
+  if (*name == '/')
+    name++;
+  return strcmp (name, ".") ? name : "";
+}
+
+/* Creates a file named NAME in FS_ with the given INITIAL_SIZE,
+   all of it a hole. */
+static bool
+tmpfs_create (void *fs_, const char *name, off_t initial_size)
+{
+  struct tmpfs *fs = fs_;
+  struct tmpfs_node *node = NULL;
+
+  name = local_name (name);
+  if (*name == '\0' || strchr (name, '/') != NULL
+      || strlen (name) > NAME_MAX || initial_size < 0)
+    return false;
+
+  lock_acquire (&fs->lock);
+  if (find (fs, name) == NULL)
+    {
+      node = new_node (fs, name, false);
+      if (node != NULL)
+        {
+          node->length = initial_size;
+          list_push_back (&fs->files, &node->elem);
+        }
+    }
+  lock_release (&fs->lock);
+  return node != NULL;
+}
+
+/* Opens the file named NAME in FS_, or its directory if NAME is
+   empty. */
+static struct file *
+tmpfs_open (void *fs_, const char *name)
+{
+  struct tmpfs *fs = fs_;
+  struct tmpfs_node *node;
+
+  name = local_name (name);
+  lock_acquire (&fs->lock);
+  node = *name == '\0' ? fs->root : find (fs, name);
+  if (node != NULL)
+    node->open_cnt++;
+  lock_release (&fs->lock);
+
+  if (node == NULL)
+    return NULL;
+  return file_open_node (&tmpfs_file_ops,
+                         node->is_dir ? &tmpfs_dir_ops : NULL, node);
+}
+
+/* Removes the file named NAME from FS_.  Its pages are freed when
+   the last opener closes it. */
+static bool
+tmpfs_remove (void *fs_, const char *name)
+{
+  struct tmpfs *fs = fs_;
+  struct tmpfs_node *node;
+
+  name = local_name (name);
+  lock_acquire (&fs->lock);
+  node = *name != '\0' ? find (fs, name) : NULL;
+  if (node != NULL)
+    {
+      list_remove (&node->elem);
+      node->removed = true;
+      if (node->open_cnt == 0)
+        free_node (node);
+    }
+  lock_release (&fs->lock);
+  return node != NULL;
+}
+
+static const struct vfs_inode_ops tmpfs_inode_ops =
+  {
+    tmpfs_create, tmpfs_open, tmpfs_remove,
+  };
+
+/* Open files. */
+
+static off_t
+tmpfs_read_at (void *node_, void *buffer_, off_t size, off_t offset)
+{
+  struct tmpfs_node *node = node_;
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  lock_acquire (&node->fs->lock);
+  while (size > 0 && offset < node->length)
+    {
+      size_t idx = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      off_t inode_left = node->length - offset;
+      int page_left = PGSIZE - page_ofs;
+      int chunk_size = size < page_left ? size : page_left;
+      if (chunk_size > inode_left)
+        chunk_size = inode_left;
+
+      if (idx < node->page_cnt && node->pages[idx] != NULL)
+        memcpy (buffer + bytes_read, node->pages[idx] + page_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  lock_release (&node->fs->lock);
+  return bytes_read;
+}
+
+static off_t
+tmpfs_write_at (void *node_, const void *buffer_, off_t size, off_t offset)
+{
+  struct tmpfs_node *node = node_;
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  if (node->deny_write_cnt || node->is_dir)
+    return 0;
+
+  lock_acquire (&node->fs->lock);
+  while (size > 0)
+    {
+      int page_ofs = offset % PGSIZE;
+      int page_left = PGSIZE - page_ofs;
+      int chunk_size = size < page_left ? size : page_left;
+      uint8_t *page = get_page (node, offset / PGSIZE);
+
+      if (page == NULL)
+        break;
+      memcpy (page + page_ofs, buffer + bytes_written, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  if (bytes_written > 0 && offset > node->length)
+    node->length = offset;
+  lock_release (&node->fs->lock);
+  return bytes_written;
+}
+
+static off_t
+tmpfs_length (void *node_)
+{
+  struct tmpfs_node *node = node_;
+  return node->length;
+}
+
+/* Gives every hole in the SIZE bytes of NODE_ starting at OFFSET
+   a page, and extends NODE_ to OFFSET + SIZE bytes if it is
+   shorter. */
+static bool
+tmpfs_allocate (void *node_, off_t offset, off_t size)
+{
+  struct tmpfs_node *node = node_;
+  off_t end = offset + size;
+  size_t idx;
+  bool success = true;
+
+  if (offset < 0 || size <= 0 || end < offset || node->deny_write_cnt
+      || node->is_dir)
+    return false;
+
+  lock_acquire (&node->fs->lock);
+  for (idx = offset / PGSIZE;
+       success && idx < (size_t) DIV_ROUND_UP (end, PGSIZE);
+       idx++)
+    success = get_page (node, idx) != NULL;
+  if (success && end > node->length)
+    node->length = end;
+  lock_release (&node->fs->lock);
+  return success;
+}
+
+/* Sets NODE_'s length to LENGTH bytes.  Shrinking frees the pages
+   wholly past the new end of file and zeroes the rest of the last
+   one; growing leaves a hole. */
+static bool
+tmpfs_truncate (void *node_, off_t length)
+{
+  struct tmpfs_node *node = node_;
+  size_t keep, idx;
+
+  if (length < 0 || node->deny_write_cnt || node->is_dir)
+    return false;
+
+  lock_acquire (&node->fs->lock);
+  keep = DIV_ROUND_UP (length, PGSIZE);
+  for (idx = keep; idx < node->page_cnt; idx++)
+    if (node->pages[idx] != NULL)
+      {
+        palloc_free_page (node->pages[idx]);
+        node->pages[idx] = NULL;
+        node->fs->used_pages--;
+      }
+  if (length % PGSIZE != 0 && keep <= node->page_cnt
+      && node->pages[keep - 1] != NULL)
+    memset (node->pages[keep - 1] + length % PGSIZE, 0,
+            PGSIZE - length % PGSIZE);
+  node->length = length;
+  lock_release (&node->fs->lock);
+  return true;
+}
+
+static void
+tmpfs_deny_write (void *node_)
+{
+  struct tmpfs_node *node = node_;
+  node->deny_write_cnt++;
+  ASSERT (node->deny_write_cnt <= node->open_cnt);
+}
+
+static void
+tmpfs_allow_write (void *node_)
+{
+  struct tmpfs_node *node = node_;
+  ASSERT (node->deny_write_cnt > 0);
+  node->deny_write_cnt--;
+}
+
+static void *
+tmpfs_reopen (void *node_)
+{
+  struct tmpfs_node *node = node_;
+
+  lock_acquire (&node->fs->lock);
+  ASSERT (node->open_cnt > 0);
+  node->open_cnt++;
+  lock_release (&node->fs->lock);
+  return node;
+}
+
+/* Closes NODE_, freeing it if it has been removed and this was
+   its last opener. */
+static void
+tmpfs_close (void *node_)
+{
+  struct tmpfs_node *node = node_;
+  struct tmpfs *fs = node->fs;
+
+  lock_acquire (&fs->lock);
+  if (--node->open_cnt == 0 && node->removed)
+    free_node (node);
+  lock_release (&fs->lock);
+}
+
+static const struct vfs_file_ops tmpfs_file_ops =
+  {
+    tmpfs_read_at, tmpfs_write_at, tmpfs_length, tmpfs_allocate,
+    tmpfs_truncate, NULL, tmpfs_deny_write, tmpfs_allow_write,
+    tmpfs_reopen, tmpfs_close,
+  };
+
+/* The directory. */
+
+/* Reads up to CNT entries of the directory NODE_ into ENTRIES,
+   starting with the *POS'th file. */
+static size_t
+tmpfs_readdir (void *node_, off_t *pos, struct vfs_dirent entries[],
+               size_t cnt)
+{
+  struct tmpfs_node *dir = node_;
+  struct tmpfs *fs = dir->fs;
+  struct list_elem *e;
+  off_t skip = *pos;
+  size_t n = 0;
+
+  lock_acquire (&fs->lock);
+  for (e = list_begin (&fs->files); e != list_end (&fs->files) && n < cnt;
+       e = list_next (e))
+    if (skip > 0)
+      skip--;
+    else
+      {
+        struct tmpfs_node *node = list_entry (e, struct tmpfs_node, elem);
+        struct vfs_dirent *d = &entries[n++];
+
+        strlcpy (d->name, node->name, sizeof d->name);
+        d->is_dir = false;
+        d->inumber = node->inumber;
+        d->size = node->length;
+      }
+  lock_release (&fs->lock);
+  *pos += n;
+  return n;
+}
+
+static const struct vfs_dir_ops tmpfs_dir_ops =
+  {
+    tmpfs_readdir,
+  };
+
+/* Mounts a new, empty tmpfs at POINT, which may use up to
+   MAX_PAGES pages for file data.  Returns true if successful,
+   false if memory is exhausted or POINT cannot be mounted on. */
+bool
+tmpfs_mount (const char *point, size_t max_pages)
+{
+  struct tmpfs *fs = malloc (sizeof *fs);
+
+  if (fs == NULL)
+    return false;
+  list_init (&fs->files);
+  lock_init (&fs->lock);
+  fs->used_pages = 0;
+  fs->max_pages = max_pages;
+  fs->next_inumber = 1;
+  fs->root = new_node (fs, "", true);
+  if (fs->root == NULL || !vfs_mount (point, &tmpfs_inode_ops, fs))
+    {
+      free (fs->root);
+      free (fs);
+      return false;
+    }
+
+  /* The mount keeps the directory open, so it is never freed. */
+  fs->root->open_cnt = 1;
+  return true;
+}
@@ -0,0 +1,13 @@
+#ifndef FILESYS_TMPFS_H
+#define FILESYS_TMPFS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Pages a tmpfs mounted with -tmpfs may use for data, so that it
+   cannot take the whole kernel pool. */
+#define TMPFS_MAX_PAGES 128
+
+bool tmpfs_mount (const char *point, size_t max_pages);
+
+#endif /* filesys/tmpfs.h */
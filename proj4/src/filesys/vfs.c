@@ -0,0 +1,70 @@
+#include "filesys/vfs.h"
+#include <debug.h>
+#include <string.h>
+
+/* Mount table.  File systems are only mounted while the kernel
+   starts up, before any other thread looks names up, so the table
+   needs no lock. */
+#define VFS_MAX_MOUNTS 4
+static struct vfs_mount mounts[VFS_MAX_MOUNTS];
+static size_t mount_cnt;
+
+/* Mounts the file system FS, whose names OPS operates on, at
+   POINT, a name in the root directory, or at the root itself if
+   POINT is "/".  Names under POINT then go to FS instead of to the
+   file system that holds POINT.
+   Returns true if successful, false if POINT is not a valid name,
+   is already a mount point, or there are too many mounts. */
+bool
+vfs_mount (const char *point, const struct vfs_inode_ops *ops, void *fs)
+{
+  struct vfs_mount *m;
+  size_t i;
+
+  ASSERT (ops != NULL);
+
+  if (*point == '/')
+    point++;
+  if (strchr (point, '/') != NULL || strlen (point) > NAME_MAX
+      || mount_cnt >= VFS_MAX_MOUNTS)
+    return false;
+  for (i = 0; i < mount_cnt; i++)
+    if (!strcmp (mounts[i].point, point))
+      return false;
+
+  m = &mounts[mount_cnt++];
+  strlcpy (m->point, point, sizeof m->point);
+  m->ops = ops;
+  m->fs = fs;
+  return true;
+}
+
+/* Returns the mounted file system that holds NAME, and stores into
+   *REST the part of NAME within it: the rest of the name after the
+   mount point, "" for the mount point itself, or all of NAME for
+   the root file system.  Returns a null pointer if no file system
+   holds NAME, which can only happen before the root is mounted. */
+const struct vfs_mount *
+vfs_resolve (const char *name, const char **rest)
+{
+  const struct vfs_mount *root = NULL;
+  const char *p = *name == '/' ? name + 1 : name;
+  size_t i;
+
+  for (i = 0; i < mount_cnt; i++)
+    {
+      const struct vfs_mount *m = &mounts[i];
+      size_t len = strlen (m->point);
+
+      if (len == 0)
+        root = m;
+      else if (strlen (p) >= len && !memcmp (p, m->point, len)
+               && (p[len] == '\0' || p[len] == '/'))
+        {
+          *rest = p[len] == '/' ? p + len + 1 : p + len;
+          return m;
+        }
+    }
+  *rest = name;
+  return root;
+}
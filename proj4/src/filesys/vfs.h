@@ -0,0 +1,74 @@
+#ifndef FILESYS_VFS_H
+#define FILESYS_VFS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/directory.h"
+#include "filesys/off_t.h"
+
+/* Virtual file system.  Each mounted file system provides its
+   operations in three tables, and filesys_*() and file_*()
+   dispatch through them, so that callers do not care whether a
+   file lives on the disk or somewhere else.  A file system's
+   nodes are opaque to the VFS: the disk's are `struct inode's,
+   tmpfs's are its own. */
+
+struct file;
+
+/* A directory entry, as read by a directory's readdir
+   operation. */
+struct vfs_dirent
+  {
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    bool is_dir;                        /* Is it a directory? */
+    int inumber;                        /* Node number. */
+    off_t size;                         /* File size in bytes. */
+  };
+
+/* Operations on the names in a mounted file system, which is FS
+   as passed to vfs_mount().  NAME is relative to the mount point,
+   and is empty for the mount point itself. */
+struct vfs_inode_ops
+  {
+    bool (*create) (void *fs, const char *name, off_t initial_size);
+    struct file *(*open) (void *fs, const char *name);
+    bool (*remove) (void *fs, const char *name);
+  };
+
+/* Operations on an open node, which a `struct file' calls on its
+   behalf.  READAHEAD may be null. */
+struct vfs_file_ops
+  {
+    off_t (*read_at) (void *node, void *, off_t size, off_t offset);
+    off_t (*write_at) (void *node, const void *, off_t size, off_t offset);
+    off_t (*length) (void *node);
+    bool (*allocate) (void *node, off_t offset, off_t size);
+    bool (*truncate) (void *node, off_t length);
+    void (*readahead) (void *node, off_t offset, off_t size);
+    void (*deny_write) (void *node);
+    void (*allow_write) (void *node);
+    void *(*reopen) (void *node);
+    void (*close) (void *node);
+  };
+
+/* Operations on an open directory.  READDIR reads up to CNT
+   entries starting at *POS into ENTRIES, advances *POS past them
+   and returns how many it read, 0 at the end of the directory. */
+struct vfs_dir_ops
+  {
+    size_t (*readdir) (void *node, off_t *pos, struct vfs_dirent entries[],
+                       size_t cnt);
+  };
+
+/* A mounted file system. */
+struct vfs_mount
+  {
+    char point[NAME_MAX + 1];           /* Mount point, "" for the root. */
+    const struct vfs_inode_ops *ops;    /* Operations on its names. */
+    void *fs;                           /* File system's own data. */
+  };
+
+bool vfs_mount (const char *point, const struct vfs_inode_ops *, void *fs);
+const struct vfs_mount *vfs_resolve (const char *name, const char **rest);
+
+#endif /* filesys/vfs.h */
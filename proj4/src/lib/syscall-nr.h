@@ -28,7 +28,15 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* File system extensions. */
+    SYS_FALLOCATE,              /* Reserve disk space for a file. */
+    SYS_FTRUNCATE,              /* Change the size of a file. */
+    SYS_DEFRAG,                 /* Make fragmented files contiguous. */
+    SYS_READDIR_BATCH,          /* Reads many directory entries. */
+    SYS_CREATE_COMPRESSED,      /* Create a compressed file. */
+    SYS_CLONE_FILE              /* Copy a file by sharing its data. */
   };
 
 #endif /* lib/syscall-nr.h */
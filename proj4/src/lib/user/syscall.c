@@ -182,3 +182,39 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+bool
+ftruncate (int fd, unsigned length)
+{
+  return syscall2 (SYS_FTRUNCATE, fd, length);
+}
+
+int
+defrag (void)
+{
+  return syscall0 (SYS_DEFRAG);
+}
+
+int
+readdir_batch (int fd, struct readdir_entry *entries, size_t count)
+{
+  return syscall3 (SYS_READDIR_BATCH, fd, entries, count);
+}
+
+bool
+create_compressed (const char *file, unsigned initial_size)
+{
+  return syscall2 (SYS_CREATE_COMPRESSED, file, initial_size);
+}
+
+bool
+clone_file (int src_fd, const char *file)
+{
+  return syscall2 (SYS_CLONE_FILE, src_fd, file);
+}
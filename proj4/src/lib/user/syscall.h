@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -45,4 +46,22 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* File system extensions. */
+
+/* A directory entry read by readdir_batch(). */
+struct readdir_entry
+  {
+    char name[READDIR_MAX_LEN + 1];     /* Null terminated file name. */
+    bool is_dir;                        /* Is it a directory? */
+    int inumber;                        /* Inode number. */
+    int size;                           /* File size in bytes. */
+  };
+
+bool fallocate (int fd, unsigned offset, unsigned length);
+bool ftruncate (int fd, unsigned length);
+int defrag (void);
+int readdir_batch (int fd, struct readdir_entry *, size_t count);
+bool create_compressed (const char *file, unsigned initial_size);
+bool clone_file (int src_fd, const char *file);
+
 #endif /* lib/user/syscall.h */
@@ -226,3 +226,42 @@ ustar_parse_header (const char header[USTAR_HEADER_SIZE],
   return NULL;
 }
 
+
+/* Walks the SIZE-byte ustar archive at ARCHIVE, which is already
+   in memory, calling ACTION with AUX for each file and directory
+   in it, in archive order.  Returns a null pointer if it reaches
+   the end of the archive or ACTION returns false, otherwise a
+   human-readable error message. */
+const char *
+ustar_unpack (const void *archive, size_t size, ustar_action_func *action,
+              void *aux)
+{
+  const char *p = archive;
+  const char *end = p + size;
+
+  while ((size_t) (end - p) >= USTAR_HEADER_SIZE)
+    {
+      const char *file_name, *error;
+      enum ustar_type type;
+      int file_size;
+      size_t padded_size;
+
+      error = ustar_parse_header (p, &file_name, &type, &file_size);
+      if (error != NULL)
+        return error;
+      if (type == USTAR_EOF)
+        return NULL;
+      p += USTAR_HEADER_SIZE;
+
+      padded_size = ((size_t) file_size + USTAR_HEADER_SIZE - 1)
+                    / USTAR_HEADER_SIZE * USTAR_HEADER_SIZE;
+      if (padded_size > (size_t) (end - p))
+        return "archive truncated";
+      if (!action (file_name, type, p, file_size, aux))
+        return NULL;
+      p += padded_size;
+    }
+
+  /* An archive may end without its end-of-archive blocks. */
+  return p == end ? NULL : "archive truncated";
+}
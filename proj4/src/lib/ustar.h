@@ -6,6 +6,7 @@
    "ustar" format specification. */
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /* Type of a file entry in an archive.
    The values here are the bytes that appear in the file format.
@@ -26,4 +27,12 @@ const char *ustar_parse_header (const char header[USTAR_HEADER_SIZE],
                                 const char **file_name,
                                 enum ustar_type *, int *size);
 
+/* Called by ustar_unpack() for each file or directory in an
+   archive, with its name, type, and SIZE bytes of DATA.  Returns
+   true to go on to the next entry, false to stop. */
+typedef bool ustar_action_func (const char *file_name, enum ustar_type,
+                                const void *data, int size, void *aux);
+const char *ustar_unpack (const void *archive, size_t size,
+                          ustar_action_func *, void *aux);
+
 #endif /* lib/ustar.h */
@@ -0,0 +1,47 @@
+/* Creates files in the root directory and checks that
+   readdir_batch reports each of them exactly once, with the
+   right size, when the directory is read a few entries at a
+   time. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 3
+static const char *names[FILE_CNT] = {"a", "b", "c"};
+static const int sizes[FILE_CNT] = {10, 600, 0};
+
+void
+test_main (void) 
+{
+  struct readdir_entry entries[2];
+  int seen[FILE_CNT];
+  int fd, n, i, j;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      CHECK (create (names[i], sizes[i]), "create \"%s\"", names[i]);
+      seen[i] = 0;
+    }
+
+  CHECK ((fd = open (".")) > 1, "open \".\"");
+  msg ("read entries in batches");
+  while ((n = readdir_batch (fd, entries, 2)) > 0)
+    for (i = 0; i < n; i++)
+      for (j = 0; j < FILE_CNT; j++)
+        if (!strcmp (entries[i].name, names[j]))
+          {
+            if (entries[i].is_dir || entries[i].size != sizes[j])
+              fail ("\"%s\" reported with size %d, should be %d",
+                    names[j], entries[i].size, sizes[j]);
+            seen[j]++;
+          }
+  if (n < 0)
+    fail ("readdir_batch failed");
+  for (j = 0; j < FILE_CNT; j++)
+    if (seen[j] != 1)
+      fail ("\"%s\" reported %d times", names[j], seen[j]);
+  msg ("close \".\"");
+  close (fd);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-readdir-batch) begin
+(dir-readdir-batch) create "a"
+(dir-readdir-batch) create "b"
+(dir-readdir-batch) create "c"
+(dir-readdir-batch) open "."
+(dir-readdir-batch) read entries in batches
+(dir-readdir-batch) close "."
+(dir-readdir-batch) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($orig) = substr ("abcdefghijklmnopqrstuvwxyz" x 231, 0, 6000);
+my ($clone) = $orig;
+substr ($clone, 3000, 200) = 'x' x 200;
+check_archive ({"orig" => [$orig], "clone" => [$clone]});
+pass;
@@ -0,0 +1,46 @@
+/* Clones a file, overwrites part of the clone in the middle, and
+   checks that the clone reads back with the change and the
+   original without it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 6000
+#define PATCH_OFS 3000
+#define PATCH_SIZE 200
+static char buf[FILE_SIZE];
+static char patched[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "orig";
+  const char *clone_name = "clone";
+  size_t ofs;
+  int fd;
+
+  for (ofs = 0; ofs < FILE_SIZE; ofs++)
+    buf[ofs] = 'a' + ofs % 26;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"%s\"", file_name);
+  CHECK (clone_file (fd, clone_name), "clone \"%s\" to \"%s\"",
+         file_name, clone_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  memcpy (patched, buf, FILE_SIZE);
+  memset (patched + PATCH_OFS, 'x', PATCH_SIZE);
+  CHECK ((fd = open (clone_name)) > 1, "open \"%s\"", clone_name);
+  seek (fd, PATCH_OFS);
+  CHECK (write (fd, patched + PATCH_OFS, PATCH_SIZE) == PATCH_SIZE,
+         "overwrite \"%s\"", clone_name);
+  msg ("close \"%s\"", clone_name);
+  close (fd);
+
+  check_file (file_name, buf, FILE_SIZE);
+  check_file (clone_name, patched, FILE_SIZE);
+}
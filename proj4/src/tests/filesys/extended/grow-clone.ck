@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-clone) begin
+(grow-clone) create "orig"
+(grow-clone) open "orig"
+(grow-clone) write "orig"
+(grow-clone) clone "orig" to "clone"
+(grow-clone) close "orig"
+(grow-clone) open "clone"
+(grow-clone) overwrite "clone"
+(grow-clone) close "clone"
+(grow-clone) open "orig" for verification
+(grow-clone) verified contents of "orig"
+(grow-clone) close "orig"
+(grow-clone) open "clone" for verification
+(grow-clone) verified contents of "clone"
+(grow-clone) close "clone"
+(grow-clone) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($log) = substr ("Pintos compresses this line of text.\n" x 300, 0, 10000);
+substr ($log, 5000, 100) = 'x' x 100;
+check_archive ({"log" => [$log]});
+pass;
@@ -0,0 +1,42 @@
+/* Writes repetitive text to a compressed file a piece at a time,
+   overwrites part of it in the middle, and checks that the file
+   reads back correctly. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 10000
+#define CHUNK_SIZE 1000
+#define PATCH_OFS 5000
+#define PATCH_SIZE 100
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  static const char line[] = "Pintos compresses this line of text.\n";
+  const char *file_name = "log";
+  size_t ofs;
+  int fd;
+
+  for (ofs = 0; ofs < FILE_SIZE; ofs++)
+    buf[ofs] = line[ofs % (sizeof line - 1)];
+
+  CHECK (create_compressed (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("write \"%s\"", file_name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (write (fd, buf + ofs, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("write %d bytes at offset %zu failed", CHUNK_SIZE, ofs);
+
+  memset (buf + PATCH_OFS, 'x', PATCH_SIZE);
+  seek (fd, PATCH_OFS);
+  CHECK (write (fd, buf + PATCH_OFS, PATCH_SIZE) == PATCH_SIZE,
+         "overwrite \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  check_file (file_name, buf, FILE_SIZE);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-compressed) begin
+(grow-compressed) create "log"
+(grow-compressed) open "log"
+(grow-compressed) write "log"
+(grow-compressed) overwrite "log"
+(grow-compressed) close "log"
+(grow-compressed) open "log" for verification
+(grow-compressed) verified contents of "log"
+(grow-compressed) close "log"
+(grow-compressed) end
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Grows two files a chunk at a time, closing each after every
+   chunk so that its delayed data is allocated right away and the
+   two files' blocks are interleaved on disk.  Then defragments
+   the file system, checks that it moved something, and checks
+   that both files' contents survived being moved. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 6144
+#define CHUNK_SIZE 512
+static char buf_a[FILE_SIZE];
+static char buf_b[FILE_SIZE];
+
+/* Appends CHUNK_SIZE bytes from BUF at offset OFS to the file
+   named NAME, opening and closing it around the write. */
+static void
+append_chunk (const char *name, const char *buf, size_t ofs)
+{
+  int fd = open (name);
+
+  if (fd < 2)
+    fail ("open \"%s\" failed", name);
+  seek (fd, ofs);
+  if (write (fd, buf + ofs, CHUNK_SIZE) != CHUNK_SIZE)
+    fail ("write %d bytes at offset %zu in \"%s\" failed",
+          CHUNK_SIZE, ofs, name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  size_t ofs;
+
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  random_bytes (buf_b, sizeof buf_b);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK (create ("b", 0), "create \"b\"");
+
+  msg ("append to \"a\" and \"b\" alternately");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE) 
+    {
+      append_chunk ("a", buf_a, ofs);
+      append_chunk ("b", buf_b, ofs);
+    }
+
+  CHECK (defrag () > 0, "defrag moves fragmented files");
+
+  check_file ("a", buf_a, FILE_SIZE);
+  check_file ("b", buf_b, FILE_SIZE);
+}
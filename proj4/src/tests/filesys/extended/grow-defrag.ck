@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-defrag) begin
+(grow-defrag) create "a"
+(grow-defrag) create "b"
+(grow-defrag) append to "a" and "b" alternately
+(grow-defrag) defrag moves fragmented files
+(grow-defrag) open "a" for verification
+(grow-defrag) verified contents of "a"
+(grow-defrag) close "a"
+(grow-defrag) open "b" for verification
+(grow-defrag) verified contents of "b"
+(grow-defrag) close "b"
+(grow-defrag) end
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Reserves space for a file with fallocate, fills it, then
+   shrinks and regrows it with ftruncate, and checks that the
+   bytes that were cut off come back as zeros. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 9000
+#define CUT_SIZE 4321
+static char buf[FILE_SIZE];
+
+static void
+check_size (int fd, int size) 
+{
+  int actual = filesize (fd);
+  if (actual != size)
+    fail ("file size should be %d, actually %d", size, actual);
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (fallocate (fd, 0, FILE_SIZE), "fallocate \"%s\"", file_name);
+  check_size (fd, FILE_SIZE);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"%s\"", file_name);
+  CHECK (ftruncate (fd, CUT_SIZE), "shrink \"%s\"", file_name);
+  check_size (fd, CUT_SIZE);
+  CHECK (ftruncate (fd, FILE_SIZE), "grow \"%s\"", file_name);
+  check_size (fd, FILE_SIZE);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  memset (buf + CUT_SIZE, 0, FILE_SIZE - CUT_SIZE);
+  check_file (file_name, buf, FILE_SIZE);
+}
@@ -0,0 +1,40 @@
+/* With a tmpfs mounted at "tmp", writes a file under it, lists
+   the mount point with readdir_batch, reads the file back and
+   removes it.  Nothing should reach the disk. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 6000
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "/tmp/scratch";
+  struct readdir_entry entries[2];
+  size_t ofs;
+  int fd;
+
+  for (ofs = 0; ofs < FILE_SIZE; ofs++)
+    buf[ofs] = 'a' + ofs % 26;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK ((fd = open ("/tmp")) > 1, "open \"/tmp\"");
+  CHECK (readdir_batch (fd, entries, 2) == 1
+         && !strcmp (entries[0].name, "scratch")
+         && entries[0].size == FILE_SIZE, "readdir_batch \"/tmp\"");
+  msg ("close \"/tmp\"");
+  close (fd);
+
+  check_file (file_name, buf, FILE_SIZE);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+  CHECK (open (file_name) == -1, "open \"%s\" after removal", file_name);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-tmpfs) begin
+(grow-tmpfs) create "/tmp/scratch"
+(grow-tmpfs) open "/tmp/scratch"
+(grow-tmpfs) write "/tmp/scratch"
+(grow-tmpfs) close "/tmp/scratch"
+(grow-tmpfs) open "/tmp"
+(grow-tmpfs) readdir_batch "/tmp"
+(grow-tmpfs) close "/tmp"
+(grow-tmpfs) open "/tmp/scratch" for verification
+(grow-tmpfs) verified contents of "/tmp/scratch"
+(grow-tmpfs) close "/tmp/scratch"
+(grow-tmpfs) remove "/tmp/scratch"
+(grow-tmpfs) open "/tmp/scratch" after removal
+(grow-tmpfs) end
+EOF
+pass;
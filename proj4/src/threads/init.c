@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -247,6 +248,16 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_configure (value != NULL ? atoi (value) : 0);
+      else if (!strcmp (name, "-iosched"))
+        block_configure_sched (value);
+      else if (!strcmp (name, "-fs-block"))
+        filesys_configure (atoi (value));
+      else if (!strcmp (name, "-fs-log"))
+        filesys_configure_log ();
+      else if (!strcmp (name, "-tmpfs"))
+        filesys_configure_tmpfs (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -313,6 +324,7 @@ run_actions (char **argv)
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
+      {"defrag", 1, fsutil_defrag},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
 #endif
@@ -361,6 +373,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  defrag             Move fragmented files into contiguous space.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -373,6 +386,12 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=BLOCKS      Cache BLOCKS file system blocks (default 64).\n"
+          "  -iosched=SCHED     Order disk requests with SCHED: noop, clook,\n"
+          "                     or deadline (default).\n"
+          "  -fs-block=BYTES    Format with BYTES-byte blocks (default 512).\n"
+          "  -fs-log            Format as a log-structured file system.\n"
+          "  -tmpfs=DIR         Mount a memory-backed file system at DIR.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
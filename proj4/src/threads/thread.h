@@ -106,6 +106,7 @@ struct thread
 
     // proj 4
     //struct dir *currentDirectory;
+    int journal_depth; // Journal handles open in this thread (filesys/journal.c)
     
 
 #ifdef USERPROG
@@ -162,4 +163,8 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
+/* Serializes file system system calls. */
+void acquireFilesysLock (void);
+void releaseFilesysLock (void);
+
 #endif /* threads/thread.h */
\ No newline at end of file
@@ -17,12 +17,14 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/vfs.h"
 
 extern bool running;
 
 static void syscall_handler (struct intr_frame *);
 
 void* check( const void* );
+void checkBuffer( const void*, size_t );
 struct processFile* traverse( struct list* files, int fd );
 
 struct processFile { // A struct that holds info about a file the current thread is associated with
@@ -173,6 +175,107 @@ struct processFile { // A struct that holds info about a file the current thread
 
 // }
 
+static bool allocateFile( int fd, off_t offset, off_t length ) {
+
+	struct processFile *pf = traverse( &thread_current()->files, fd );
+
+	if ( pf == NULL || offset < 0 || length <= 0 ) {
+
+		return false;
+
+	}
+
+	return file_allocate( pf->point, offset, length );
+
+}
+
+static bool truncateFile( int fd, off_t length ) {
+
+	struct processFile *pf = traverse( &thread_current()->files, fd );
+
+	if ( pf == NULL || length < 0 ) {
+
+		return false;
+
+	}
+
+	return file_truncate( pf->point, length );
+
+}
+
+static bool cloneFile( int fd, const char *name ) {
+
+	struct processFile *pf = traverse( &thread_current()->files, fd );
+
+	if ( pf == NULL ) {
+
+		return false;
+
+	}
+
+	return filesys_clone( pf->point, name );
+
+}
+
+static int defragFilesys( void ) {
+
+	struct frag_stats before, after;
+
+	filesys_defrag( &before, &after );
+
+	return (int) after.moved;
+
+}
+
+/* Fills up to COUNT ENTRIES from the directory open as FD, starting
+   at its current position, and returns how many were filled, 0 at
+   the end of the directory, or -1 if FD is not an open directory.
+   Entries are read from the file system READDIR_CHUNK at a time.
+   The system call fills at most READDIR_BATCH_MAX entries. */
+#define READDIR_CHUNK 8
+#define READDIR_BATCH_MAX 256
+static int readDirBatch( int fd, struct readdir_entry *entries, size_t count ) {
+
+	struct processFile *pf = traverse( &thread_current()->files, fd );
+
+	if ( pf == NULL || !file_is_dir(pf->point) ) {
+
+		return -1;
+
+	}
+
+	struct vfs_dirent chunk[READDIR_CHUNK];
+	size_t n = 0;
+
+	while ( n < count ) {
+
+		size_t want = count - n < READDIR_CHUNK ? count - n : READDIR_CHUNK;
+		size_t got = file_readdir( pf->point, chunk, want );
+		size_t j;
+
+		for ( j = 0; j < got; j++ ) {
+
+			struct readdir_entry *e = &entries[n++];
+
+			strlcpy( e->name, chunk[j].name, sizeof e->name );
+			e->is_dir = chunk[j].is_dir;
+			e->inumber = chunk[j].inumber;
+			e->size = chunk[j].size;
+
+		}
+
+		if ( got < want ) {
+
+			break;
+
+		}
+
+	}
+
+	return n;
+
+}
+
 int executeProcess ( char *fileName ) {
 
 	acquireFilesysLock();
@@ -253,6 +356,34 @@ void* check ( const void *vaddr ) {
 
 }
 
+void checkBuffer ( const void *buffer, size_t size ) { // Checks every page of a user buffer of SIZE bytes
+
+	const uint8_t *p = buffer;
+	const uint8_t *end = p + size;
+
+	if ( size == 0 ) {
+
+		return;
+
+	}
+
+	if ( end < p ) {
+
+		exitProcess(-1);
+		return;
+
+	}
+
+	for ( ; p < end; p = (const uint8_t *) pg_round_down( p ) + PGSIZE ) {
+
+		check( p );
+
+	}
+
+	check( end - 1 );
+
+}
+
 struct processFile* traverse ( struct list* files, int fd ) {
 
 	struct list_elem *l;
@@ -542,6 +673,69 @@ syscall_handler (struct intr_frame *f UNUSED)
 
     //   break;
 
+  	case SYS_FALLOCATE:
+  		check( i + 3 );
+
+  		acquireFilesysLock();
+  		f->eax = (uint32_t) allocateFile( (int) *(i + 1), (off_t) *(i + 2), (off_t) *(i + 3) );
+  		releaseFilesysLock();
+
+  		break;
+
+  	case SYS_FTRUNCATE:
+  		check( i + 2 );
+
+  		acquireFilesysLock();
+  		f->eax = (uint32_t) truncateFile( (int) *(i + 1), (off_t) *(i + 2) );
+  		releaseFilesysLock();
+
+  		break;
+
+  	case SYS_DEFRAG:
+  		acquireFilesysLock();
+  		f->eax = (uint32_t) defragFilesys();
+  		releaseFilesysLock();
+
+  		break;
+
+  	case SYS_READDIR_BATCH: {
+  		check( i + 3 );
+
+  		size_t count = (size_t) *(i + 3);
+
+  		if ( count > READDIR_BATCH_MAX ) {
+  			count = READDIR_BATCH_MAX;
+  		}
+  		checkBuffer( (void *) *(i + 2), count * sizeof (struct readdir_entry) );
+
+  		acquireFilesysLock();
+  		f->eax = (uint32_t) readDirBatch( (int) *(i + 1),
+  			(struct readdir_entry *) *(i + 2), count );
+  		releaseFilesysLock();
+
+  		break;
+  	}
+
+  	case SYS_CREATE_COMPRESSED:
+  		check( i + 2 );
+  		check( (void *) *(i + 1) );
+
+  		acquireFilesysLock();
+  		f->eax = filesys_create_compressed( (const char *) *(i + 1), (off_t) *(i + 2) );
+  		releaseFilesysLock();
+
+  		break;
+
+  	case SYS_CLONE_FILE:
+  		check( i + 2 );
+  		check( (void *) *(i + 2) );
+
+  		acquireFilesysLock();
+  		f->eax = (uint32_t) cloneFile( (int) *(i + 1), (const char *) *(i + 2) );
+  		releaseFilesysLock();
+
+  		break;
+
   	default:
   		printf("default %d\n", *i);
   }